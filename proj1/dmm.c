@@ -1,228 +1,2066 @@
+#define _GNU_SOURCE // needed for mremap and sched_getcpu
+#ifdef DMM_ARENA_BY_CPU
+#include <sched.h>
+#endif
 #include <stdio.h>  // needed for size_t
+#include <string.h> // needed for memcpy and memset
+#include <errno.h>  // needed for EINVAL and ENOMEM
 #include <unistd.h> // needed for sbrk
 #include <assert.h> // needed for asserts
+#include <stdint.h> // needed for intptr_t and uint64_t
+#include <sys/mman.h> // needed for mmap
+#if defined(DMM_THREAD_SAFE) || defined(DMM_TRACE)
+#include <pthread.h>
+#endif
+#if defined(DMM_TRACE) || defined(DMM_HARDENED)
+#include <stdlib.h> // needed for getenv, atexit and abort
+#endif
+#ifdef DMM_TRACE
+#include <fcntl.h>
+#include <time.h>
+#endif
+#ifdef DMM_HARDENED
+#include <sys/auxv.h> // needed for getauxval
+#endif
 #include "dmm.h"
 
-/* You can improve the below metadata structure using the concepts from Bryant
- * and OHallaron book (chapter 9).
+/* Hardened builds need every free to reach the checks, so they leave the
+ * thread caches and fast bins out.
+ */
+#if defined(DMM_THREAD_SAFE) && !defined(DMM_HARDENED)
+#define DMM_TCACHE
+#endif
+#ifdef DMM_HARDENED
+#undef DMM_FASTBINS
+#endif
+
+/* Blocks use the optimized boundary-tag layout from Bryant and O'Hallaron
+ * (chapter 9). Every block starts with a one-word header holding the size of
+ * the whole block, header included, plus two flag bits: bit 0 says the block
+ * is allocated and bit 1 says the block physically before it is allocated.
+ * Allocated blocks have no footer. Free blocks keep their free-list links in
+ * what would be the payload and end with a footer repeating their size, which
+ * is only ever read when the next block is freed and finds its PREV_ALLOC bit
+ * clear. metadata_t overlays the header and links of a block. Bit 2 marks a
+ * large block that has its own mapping outside the heap (see mmap_alloc).
  */
 
 typedef struct metadata {
   /* size_t is the return type of the sizeof operator. Since the size of an
    * object depends on the architecture and its implementation, size_t is used
    * to represent the maximum size of any object in the particular
-   * implementation. size contains the size of the data object or the number of
-   * free bytes
+   * implementation. size contains the size of the whole block and its flags
    */
   size_t size;
-  struct metadata* next;
-  struct metadata* prev;
+  struct metadata* next; //Only valid while the block is free
+  struct metadata* prev; //Only valid while the block is free
 } metadata_t;
 
 typedef struct footer {
   size_t size;
 } footer_t;
 
+#define HDR_T_ALIGNED SIZE_T_ALIGNED
 #define FOOTER_T_ALIGNED (ALIGN(sizeof(footer_t)))
 #define PACK(size, alloc) ((size) | (alloc))
+#define PREV_ALLOC 0x2
+#define IS_MMAPPED 0x4
+
+/* Allocated blocks record the index of the arena that owns them in the top
+ * byte of the header, which no real block size reaches.
+ */
+#define ARENA_SHIFT 56
+#define SIZE_MASK (((((size_t) 1) << ARENA_SHIFT) - 1) & ~0x7)
+#define PACK_ARENA(size, arena) (PACK(size, 1) | ((size_t) ((arena) - arenas) << ARENA_SHIFT))
+#define GET_ARENA_H(p) (&arenas[GET_H(p) >> ARENA_SHIFT])
 #define GET_H(p) ((metadata_t *)(p))->size
 #define GET_F(p) ((footer_t *)(p))->size
-#define GET_SIZE_H(p) (GET_H(p) & ~0x7)
+#define GET_SIZE_H(p) (GET_H(p) & SIZE_MASK)
 #define GET_ALLOC_H(p) (GET_H(p) & 0x1)
-#define GET_SIZE_F(p) (GET_F(p) & ~0x7)
-#define GET_ALLOC_F(p) (GET_F(p) & 0x1)
-#define HDRP(bp) ((char*)(bp) - METADATA_T_ALIGNED)
-#define FTRP(bp) ((char*)(bp) + GET_SIZE_H(HDRP(bp)))
+#define GET_PREV_ALLOC_H(p) (GET_H(p) & PREV_ALLOC)
+#define GET_MMAPPED_H(p) (GET_H(p) & IS_MMAPPED)
+#define GET_SIZE_F(p) (GET_F(p) & SIZE_MASK)
+#define HDRP(bp) ((char*)(bp) - HDR_T_ALIGNED)
+#define PAYLOAD(h) ((void*) ((char*)(h) + HDR_T_ALIGNED))
 
-/* freelist maintains all the blocks which are not in use; freelist is kept
- * sorted to improve coalescing efficiency 
+/* Header-relative navigation: the footer of a free block, the header of the
+ * block physically after it, and the footer and header of the block
+ * physically before it (only meaningful when that block is free).
  */
+#define BLOCK_FTR(h) ((footer_t*) ((char*)(h) + GET_SIZE_H(h) - FOOTER_T_ALIGNED))
+#define NEXT_HDR(h) ((metadata_t*) ((char*)(h) + GET_SIZE_H(h)))
+#define PREV_FTR(h) ((footer_t*) ((char*)(h) - FOOTER_T_ALIGNED))
+#define PREV_HDR(h) ((metadata_t*) ((char*)(h) - GET_SIZE_F(PREV_FTR(h))))
 
-static metadata_t* freelist = NULL;
+/* Smallest block: room for the free-list links and a footer once it is
+ * freed. Also the smallest free block worth splitting off.
+ */
+#define MIN_BLOCK (METADATA_T_ALIGNED + FOOTER_T_ALIGNED)
 
-void* dmalloc(size_t numbytes) {
+/* Hardened builds end every allocated heap block with a canary word */
+#ifdef DMM_HARDENED
+#define CANARY_SIZE ALIGNMENT
+#else
+#define CANARY_SIZE 0
+#endif
+
+/* Size of the block that holds an aligned payload of size bytes */
+#define BLOCK_SIZE(size) ((size) + HDR_T_ALIGNED + CANARY_SIZE < MIN_BLOCK ? MIN_BLOCK : (size) + HDR_T_ALIGNED + CANARY_SIZE)
+
+/* Every region starts with a two-word prologue, an allocated block whose
+ * second word links to the arena's previous region, and ends with an epilogue
+ * header. REGION_OVERHEAD also leaves room to align the start of the region.
+ */
+#define PROLOGUE_SIZE (2*HDR_T_ALIGNED)
+#define REGION_OVERHEAD (PROLOGUE_SIZE + HDR_T_ALIGNED + ALIGNMENT)
+
+/* The heap is split into NUM_ARENAS independent arenas, each with its own
+ * regions, free lists and (with -DDMM_THREAD_SAFE) lock, so threads mapped to
+ * different arenas never contend. Arena 0 grows with sbrk and is the only one
+ * used by single-threaded builds; the others grow with mmap.
+ *
+ * freelist is segregated into power-of-two size classes: class i holds free
+ * blocks whose size is in [8 << i, 16 << i), and the last class holds
+ * everything larger. Freed blocks are pushed on the front of their class
+ * (LIFO), so dfree never walks a list; build with -DDMM_ADDRESS_ORDERED to keep
+ * each class sorted by address instead, which trades O(n) frees for lower
+ * fragmentation on some workloads. nonempty has bit i set iff freelist[i] !=
+ * NULL so the search can jump straight to the next populated class.
+ *
+ * Free blocks of TREE_MIN_SIZE bytes or more skip the lists and go into tree,
+ * a size-ordered treap built from the blocks themselves (see tree_insert).
+ * The free block that ends the top region, if any, is kept apart as wild and
+ * only used when nothing else fits: it is split on almost every allocation
+ * that grows the heap, which should not cost a tree update each time, and
+ * carving from it last keeps the end of the heap free to be trimmed.
+ *
+ * top is the epilogue of the region the arena last grew, and top_brk records
+ * whether that region came from sbrk; extending right after it lets the heap
+ * grow in place. regions is the prologue of that same region, from which the
+ * prologues chain back through every older one.
+ *
+ * Memory in [clean_from, top) has not been handed out since it came from the
+ * OS, so apart from the bookkeeping words of the free block covering it, it is
+ * still zero and dcalloc does not need to clear it. Growing or trimming the
+ * top region writes words that later end up inside a block, so both move
+ * clean_from past them.
+ *
+ * slab_partial and slab_empty hold the arena's slab runs (see below) that have
+ * free slots, per slot size, and that are entirely free.
+ *
+ * os_bytes, alloc_hist, searches and search_steps feed dmm_get_stats: the
+ * bytes the arena holds from the OS, how many blocks it has handed out per
+ * size class, and how many free blocks find_fit looked at over how many calls.
+ *
+ * Hardened builds park freed blocks in the quarantine ring for a while before
+ * they really become free, and run a full check of the arena every
+ * HARDEN_CHECK_INTERVAL frees (see harden_check_free).
+ */
+
+#ifdef DMM_FASTBINS
+/* With -DDMM_FASTBINS, fastbin[i] chains parked blocks of exactly
+ * MIN_BLOCK + i*ALIGNMENT bytes and fast_count says how many are parked in
+ * all (see fastbin_push).
+ */
+#define FASTBIN_MAX_BLOCK BLOCK_SIZE(FASTBIN_MAX_SIZE)
+#define FASTBINS ((FASTBIN_MAX_BLOCK - MIN_BLOCK) / ALIGNMENT + 1)
+#define FASTBIN(asize) (((asize) - MIN_BLOCK) / ALIGNMENT)
+#endif
+
+#define SLAB_CLASSES (SLAB_MAX_SIZE / ALIGNMENT)
+#define SLAB_CLASS(size) ((size) / ALIGNMENT - 1)
+
+struct slab_run;
+struct tree_node;
+
+typedef struct arena {
+  metadata_t* freelist[NUM_SIZE_CLASSES];
+  struct tree_node* tree;
+  metadata_t* wild;
+  struct slab_run* slab_partial[SLAB_CLASSES];
+  struct slab_run* slab_empty;
+  unsigned int nonempty;
+  bool initialized;
+  metadata_t* top;
+  metadata_t* regions;
+  bool top_brk;
+  char* clean_from;
+  size_t os_bytes;
+  size_t alloc_hist[NUM_SIZE_CLASSES];
+  size_t searches;
+  size_t search_steps;
+#ifdef DMM_FASTBINS
+  metadata_t* fastbin[FASTBINS];
+  unsigned int fast_count;
+#endif
+#ifdef DMM_HARDENED
+  void* quarantine[QUARANTINE_BLOCKS];
+  unsigned int quarantine_next;
+  unsigned int frees_since_check;
+#endif
+#ifdef DMM_THREAD_SAFE
+  pthread_mutex_t lock;
+#endif
+} __attribute__((aligned(64))) arena_t; //Keep each arena on its own cache lines
+
+#ifdef DMM_THREAD_SAFE
+static arena_t arenas[NUM_ARENAS] = { [0 ... NUM_ARENAS-1] = { .lock = PTHREAD_MUTEX_INITIALIZER } };
+#else
+static arena_t arenas[NUM_ARENAS];
+#endif
+
+#ifdef DMM_THREAD_SAFE
+#define ARENA_LOCK(a) pthread_mutex_lock(&(a)->lock)
+#define ARENA_UNLOCK(a) pthread_mutex_unlock(&(a)->lock)
+#else
+#define ARENA_LOCK(a)
+#define ARENA_UNLOCK(a)
+#endif
+
+static bool heap_init(arena_t* arena);
+
+#ifdef DMM_HARDENED
+/* The canary of an allocated block mixes its address with a per-process
+ * secret, so a stray copy of one block cannot pass for another's. Quarantined
+ * blocks carry the complement instead, which is how a second free of the same
+ * block is told apart from a plain overflow.
+ */
+static uintptr_t canary_secret = 0;
+
+#define CANARY_SLOT(h) ((uintptr_t*) ((char*) NEXT_HDR(h) - CANARY_SIZE))
+#define CANARY(h) (canary_secret ^ (uintptr_t) (h))
+#define QUARANTINE_CANARY(h) (~CANARY(h))
+#define harden_arm(h) (*CANARY_SLOT(h) = CANARY(h))
+#else
+#define harden_arm(h)
+#endif
+
+static int size_class(size_t size) {
+  int idx = (8 * sizeof(size_t) - 1) - __builtin_clzl(size | ALIGNMENT) - 3;
+  return (idx < NUM_SIZE_CLASSES) ? idx : NUM_SIZE_CLASSES - 1;
+}
+
+/* Large free blocks are kept in a treap ordered by size and then address, so
+ * the smallest block that fits, and among equal sizes the lowest one, is found
+ * in a single descent. A node's child and parent links live in what would be
+ * the payload, and its priority is a hash of its address, so the tree needs no
+ * memory beyond the block itself while staying balanced with high
+ * probability. Lookup and insert take expected O(log n) steps; removal starts
+ * from the node itself and needs an expected O(1) rotations, which keeps
+ * coalescing cheap.
+ */
+
+typedef struct tree_node {
+  size_t size;
+  struct tree_node* child[2];
+  struct tree_node* parent;
+} tree_node_t;
+
+#define TREE_PRIORITY(n) (((uintptr_t) (n) >> 4) * 0x9e3779b97f4a7c15ULL)
+
+static bool tree_less(tree_node_t* a, tree_node_t* b) {
+  size_t sizeA = GET_SIZE_H(a), sizeB = GET_SIZE_H(b);
+  return sizeA < sizeB || (sizeA == sizeB && a < b);
+}
+
+/* Points whatever referred to old (its parent's child link or the root) at node */
+static void tree_replace(arena_t* arena, tree_node_t* old, tree_node_t* node) {
+  tree_node_t* parent = old->parent;
+  if(parent == NULL)
+    arena->tree = node;
+  else
+    parent->child[parent->child[1] == old] = node;
+  if(node != NULL)
+    node->parent = parent;
+}
+
+/* Rotates node above its parent */
+static void tree_rotate_up(arena_t* arena, tree_node_t* node) {
+  tree_node_t* parent = node->parent;
+  int dir = (parent->child[1] == node);
+  tree_replace(arena, parent, node);
+  parent->child[dir] = node->child[!dir];
+  if(parent->child[dir] != NULL)
+    parent->child[dir]->parent = parent;
+  node->child[!dir] = parent;
+  parent->parent = node;
+}
+
+static void tree_insert(arena_t* arena, tree_node_t* node) {
+  tree_node_t* parent = NULL;
+  tree_node_t** link = &arena->tree;
+  while(*link != NULL) {
+    parent = *link;
+    link = &parent->child[tree_less(parent, node)];
+  }
+  node->child[0] = node->child[1] = NULL;
+  node->parent = parent;
+  *link = node;
+  while(node->parent != NULL && TREE_PRIORITY(node) > TREE_PRIORITY(node->parent))
+    tree_rotate_up(arena, node);
+}
+
+static void tree_remove(arena_t* arena, tree_node_t* node) {
+  //Rotate the node down below its higher-priority child until it has at most one
+  while(node->child[0] != NULL && node->child[1] != NULL)
+    tree_rotate_up(arena, node->child[TREE_PRIORITY(node->child[1]) > TREE_PRIORITY(node->child[0])]);
+  tree_replace(arena, node, node->child[node->child[0] == NULL]);
+}
+
+static metadata_t* tree_find(arena_t* arena, size_t size) {
+  tree_node_t* node = arena->tree;
+  tree_node_t* best = NULL;
+  while(node != NULL) {
+    arena->search_steps++;
+    if(GET_SIZE_H(node) >= size) {
+      best = node;
+      node = node->child[0];
+    }
+    else
+      node = node->child[1];
+  }
+  return (metadata_t*) best;
+}
+
+static void freelist_insert(arena_t* arena, metadata_t* block) {
+  if(NEXT_HDR(block) == arena->top) {
+    //The block ending the top region is kept aside; a wild block left in an older region is indexed like any other
+    metadata_t* oldWild = arena->wild;
+    arena->wild = block;
+    if(oldWild == NULL)
+      return;
+    block = oldWild;
+  }
+  if(GET_SIZE_H(block) >= TREE_MIN_SIZE) {
+    tree_insert(arena, (tree_node_t*) block);
+    return;
+  }
+  int idx = size_class(GET_SIZE_H(block));
+  metadata_t* prevBlock = NULL;
+  metadata_t* nextBlock = arena->freelist[idx];
+#ifdef DMM_ADDRESS_ORDERED
+  while(nextBlock != NULL && nextBlock < block) {
+    prevBlock = nextBlock;
+    nextBlock = nextBlock->next;
+  }
+#endif
+  block->prev = prevBlock;
+  block->next = nextBlock;
+  if(prevBlock != NULL)
+    prevBlock->next = block;
+  else
+    arena->freelist[idx] = block;
+  if(nextBlock != NULL)
+    nextBlock->prev = block;
+  arena->nonempty |= 1u << idx;
+}
+
+static void freelist_remove(arena_t* arena, metadata_t* block) {
+  if(block == arena->wild) {
+    arena->wild = NULL;
+    return;
+  }
+  if(GET_SIZE_H(block) >= TREE_MIN_SIZE) {
+    tree_remove(arena, (tree_node_t*) block);
+    return;
+  }
+  int idx = size_class(GET_SIZE_H(block));
+  if(block->prev != NULL)
+    block->prev->next = block->next;
+  else
+    arena->freelist[idx] = block->next;
+  if(block->next != NULL)
+    block->next->prev = block->prev;
+  if(arena->freelist[idx] == NULL)
+    arena->nonempty &= ~(1u << idx);
+}
+
+/* Best fit within the first size class that has a block large enough. Only
+ * the request's own class can hold blocks that are too small; every block in
+ * a higher class fits, so the scan there just picks the tightest one. Requests
+ * the lists cannot serve, including every large one, go to the tree, and only
+ * then to the wild block.
+ */
+static metadata_t* find_fit(arena_t* arena, size_t size) {
+  int idx = size_class(size);
+  unsigned int candidates = arena->nonempty & ~((1u << idx) - 1);
+  arena->searches++;
+  while(candidates != 0) {
+    idx = __builtin_ctz(candidates);
+    metadata_t* best = NULL;
+    metadata_t* freelistIterator = arena->freelist[idx];
+    while(freelistIterator != NULL) {
+      size_t blockSize = GET_SIZE_H(freelistIterator);
+      arena->search_steps++;
+      if(blockSize >= size && (best == NULL || blockSize < GET_SIZE_H(best))) {
+        best = freelistIterator;
+        if(blockSize == size)
+          break;
+      }
+      freelistIterator = freelistIterator->next;
+    }
+    if(best != NULL)
+      return best;
+    candidates &= ~(1u << idx);
+  }
+  metadata_t* best = tree_find(arena, size);
+  if(best == NULL && arena->wild != NULL && GET_SIZE_H(arena->wild) >= size)
+    best = arena->wild;
+  return best;
+}
+
+/* Marks a free block allocated as an asize-byte block, splitting the tail off
+ * as a new free block if it is large enough to be worth keeping.
+ */
+static void place(arena_t* arena, metadata_t* block, size_t asize) {
+  size_t blockSize = GET_SIZE_H(block);
+  size_t prevAlloc = GET_PREV_ALLOC_H(block);
+  freelist_remove(arena, block);
+  //If it is not worth splitting the block (need room for another free block) just allocate the block
+  if(blockSize - asize < MIN_BLOCK) {
+    block->size = PACK_ARENA(blockSize, arena) | prevAlloc;
+    NEXT_HDR(block)->size |= PREV_ALLOC;
+    return;
+  }
+  //Otherwise split
+  block->size = PACK_ARENA(asize, arena) | prevAlloc;
+  metadata_t* newBlock = NEXT_HDR(block);
+  newBlock->size = PACK(blockSize - asize, PREV_ALLOC);
+  BLOCK_FTR(newBlock)->size = newBlock->size;
+  freelist_insert(arena, newBlock);
+}
+
+/* Merges a block that is about to become free with any free physical
+ * neighbours. The neighbours are unlinked from their classes; the merged block
+ * is marked free but left for the caller to insert.
+ */
+static metadata_t* coalesce(arena_t* arena, metadata_t* block) {
+  size_t size = GET_SIZE_H(block);
+  int before = GET_PREV_ALLOC_H(block);
+  int after = GET_ALLOC_H(NEXT_HDR(block));
+
+  //Absorb the next block if it is free
+  if(after == 0) {
+    metadata_t* nextBlock = NEXT_HDR(block);
+    freelist_remove(arena, nextBlock);
+    size += GET_SIZE_H(nextBlock);
+  }
+  //Let the previous block absorb this one if it is free
+  if(before == 0) {
+    metadata_t* prevBlock = PREV_HDR(block);
+    freelist_remove(arena, prevBlock);
+    size += GET_SIZE_H(prevBlock);
+    block = prevBlock;
+  }
+  //Whatever precedes the merged block cannot be free
+  block->size = PACK(size, PREV_ALLOC);
+  BLOCK_FTR(block)->size = block->size;
+  NEXT_HDR(block)->size &= ~PREV_ALLOC;
+  return block;
+}
+
+/* Grows an arena by at least enough to hold an asize-byte block, rounded up to
+ * whole HEAP_CHUNK_SIZE chunks. Arena 0 asks sbrk first; everything else, and
+ * arena 0 once sbrk fails, maps memory right after the arena's top region if
+ * the kernel lets it. When the new memory directly follows the top region the
+ * old epilogue becomes the header of the new free block, which is then merged
+ * with a trailing free block. Otherwise the chunk is framed as a separate
+ * region with its own prologue and epilogue.
+ */
+static metadata_t* extend_heap(arena_t* arena, size_t asize) {
+  size_t bytes = (asize + REGION_OVERHEAD + HEAP_CHUNK_SIZE - 1) / HEAP_CHUNK_SIZE * HEAP_CHUNK_SIZE;
+  char* hint = (arena->top != NULL) ? (char*) arena->top + HDR_T_ALIGNED : NULL;
+  bool fromBrk = false;
+  metadata_t* block;
+
+  char* mem = (void *)-1;
+  if(arena == &arenas[0]) {
+    mem = sbrk(bytes);
+    fromBrk = (mem != (void *)-1);
+  }
+  if(!fromBrk) {
+    mem = mmap(arena->top_brk ? NULL : hint, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED)
+      return NULL;
+  }
+  arena->os_bytes += bytes;
+
+  if(hint != NULL && mem == hint && fromBrk == arena->top_brk) {
+    //Contiguous with the top region: reuse its epilogue as the new header
+    block = arena->top;
+    //The old epilogue and the footer before it end up inside the merged block
+    if(arena->clean_from < mem)
+      arena->clean_from = mem;
+    block->size = PACK(bytes, GET_PREV_ALLOC_H(block));
+    BLOCK_FTR(block)->size = block->size;
+    //Create epilogue
+    arena->top = NEXT_HDR(block);
+    arena->top->size = PACK(0, 1);
+    return coalesce(arena, block);
+  }
+
+  //Someone else may have left the break unaligned
+  char* end = mem + bytes;
+  mem = (char*) ALIGN((size_t) mem);
+  //Create prologue and link it in front of the older regions
+  metadata_t* prologue = (metadata_t*) mem;
+  prologue->size = PACK(PROLOGUE_SIZE, 1) | PREV_ALLOC;
+  prologue->next = arena->regions;
+  arena->regions = prologue;
+  block = NEXT_HDR(prologue);
+  block->size = PACK((end - (char*) block - HDR_T_ALIGNED) & ~(ALIGNMENT-1), PREV_ALLOC);
+  BLOCK_FTR(block)->size = block->size;
+  //Create epilogue
+  arena->top = NEXT_HDR(block);
+  arena->top->size = PACK(0, 1);
+  arena->top_brk = fromBrk;
+  arena->clean_from = (char*) block;
+  return block;
+}
+
+/* Gives the end of an arena's top region back to the OS once the free block
+ * there has grown past TRIM_THRESHOLD, keeping one chunk for the next
+ * allocation. Returns the (possibly shrunk) block.
+ */
+static metadata_t* trim_heap(arena_t* arena, metadata_t* block) {
+  size_t size = GET_SIZE_H(block);
+  char* end = (char*) arena->top + HDR_T_ALIGNED;
+  if(NEXT_HDR(block) != arena->top || size < TRIM_THRESHOLD)
+    return block;
+  if(arena->top_brk && sbrk(0) != end)
+    return block;
+  size_t release = (size - HEAP_CHUNK_SIZE) / HEAP_CHUNK_SIZE * HEAP_CHUNK_SIZE;
+  if(release == 0)
+    return block;
+  if(arena->top_brk ? sbrk(-(intptr_t) release) == (void *)-1 : munmap(end - release, release) != 0)
+    return block;
+  arena->os_bytes -= release;
+  block->size = PACK(size - release, PREV_ALLOC);
+  BLOCK_FTR(block)->size = block->size;
+  arena->top = NEXT_HDR(block);
+  arena->top->size = PACK(0, 1);
+  //The new footer and epilogue are no longer zero once the arena grows past them
+  if(arena->clean_from < (char*) arena->top + HDR_T_ALIGNED)
+    arena->clean_from = (char*) arena->top + HDR_T_ALIGNED;
+  return block;
+}
+
+#ifdef DMM_FASTBINS
+/* Fast bins defer coalescing for small heap blocks. A freed block of up to
+ * FASTBIN_MAX_BLOCK bytes is pushed on the bin for its exact size and stays
+ * marked allocated, so its neighbours do not merge with it either, and an
+ * allocation of that size pops it straight back. Request/response loops that
+ * free and reallocate the same sizes then skip the merge and re-split of the
+ * same blocks every time. Parked blocks are all coalesced and put on the free
+ * lists at once when FASTBIN_LIMIT have piled up, or when an allocation finds
+ * nothing but the wild block, or nothing at all, that fits.
+ */
+
+static void fastbin_consolidate(arena_t* arena) {
+  int idx;
+  for(idx = 0; idx < FASTBINS; idx++) {
+    metadata_t* block = arena->fastbin[idx];
+    arena->fastbin[idx] = NULL;
+    while(block != NULL) {
+      metadata_t* nextBlock = block->next;
+      freelist_insert(arena, trim_heap(arena, coalesce(arena, block)));
+      block = nextBlock;
+    }
+  }
+  arena->fast_count = 0;
+}
+
+static void fastbin_push(arena_t* arena, metadata_t* block) {
+  int idx = FASTBIN(GET_SIZE_H(block));
+  block->next = arena->fastbin[idx];
+  arena->fastbin[idx] = block;
+  if(++arena->fast_count >= FASTBIN_LIMIT)
+    fastbin_consolidate(arena);
+}
+
+static metadata_t* fastbin_pop(arena_t* arena, size_t asize) {
+  int idx = FASTBIN(asize);
+  metadata_t* block = arena->fastbin[idx];
+  if(block != NULL) {
+    arena->fastbin[idx] = block->next;
+    arena->fast_count--;
+  }
+  return block;
+}
+#endif
+
+/* Finds a free block of at least asize bytes, growing the arena if nothing
+ * fits; callers hold the arena's lock.
+ */
+static metadata_t* heap_find(arena_t* arena, size_t asize) {
   /* initialize through sbrk call first time */
-  if(freelist == NULL) {      
-    if(!dmalloc_init())
+  if(!arena->initialized) {
+    if(!heap_init(arena))
       return NULL;
   }
 
-  assert(numbytes > 0);
+  metadata_t* block = find_fit(arena, asize);
+#ifdef DMM_FASTBINS
+  //Merging the parked blocks may make room without growing or cutting into the wild block
+  if((block == NULL || block == arena->wild) && arena->fast_count != 0) {
+    fastbin_consolidate(arena);
+    block = find_fit(arena, asize);
+  }
+#endif
+  if(block == NULL) {
+    block = extend_heap(arena, asize);
+    if(block == NULL)
+      return NULL;
+    freelist_insert(arena, block);
+  }
+  return block;
+}
+
+/* Moves clean_from past a block that has just been handed out */
+static void mark_used(arena_t* arena, metadata_t* block) {
+  char* end = (char*) NEXT_HDR(block);
+  if(end > arena->clean_from && (char*) block < (char*) arena->top)
+    arena->clean_from = end;
+}
+
+/* Serves an aligned request from an arena; callers hold the arena's lock */
+static void* heap_alloc(arena_t* arena, size_t size) {
+  size_t asize = BLOCK_SIZE(size);
+#ifdef DMM_FASTBINS
+  if(asize <= FASTBIN_MAX_BLOCK) {
+    metadata_t* parked = fastbin_pop(arena, asize);
+    if(parked != NULL)
+      return PAYLOAD(parked);
+  }
+#endif
+  metadata_t* block = heap_find(arena, asize);
+  if(block == NULL)
+    return NULL;
+  place(arena, block, asize);
+  mark_used(arena, block);
+  harden_arm(block);
+  return PAYLOAD(block);
+}
+
+/* Like heap_alloc, but the payload starts on an alignment-byte boundary. The
+ * search asks for enough slack to reach an aligned address while leaving a
+ * gap of either nothing or a whole free block; that leading gap is split off
+ * and goes back on the free lists, so the padding is not lost.
+ */
+static void* heap_aligned_alloc(arena_t* arena, size_t alignment, size_t size) {
+  size_t asize = BLOCK_SIZE(size);
+  metadata_t* block = heap_find(arena, asize + alignment + MIN_BLOCK);
+  if(block == NULL)
+    return NULL;
+
+  char* payload = PAYLOAD(block);
+  char* aligned = (char*) (((uintptr_t) payload + alignment - 1) & ~((uintptr_t) alignment - 1));
+  while(aligned != payload && aligned - payload < MIN_BLOCK)
+    aligned += alignment;
+  if(aligned != payload) {
+    //Split the leading gap off as a free block of its own
+    size_t blockSize = GET_SIZE_H(block);
+    size_t lead = aligned - payload;
+    freelist_remove(arena, block);
+    block->size = PACK(lead, GET_PREV_ALLOC_H(block));
+    BLOCK_FTR(block)->size = block->size;
+    freelist_insert(arena, block);
+    block = NEXT_HDR(block);
+    block->size = PACK(blockSize - lead, 0);
+    BLOCK_FTR(block)->size = block->size;
+    freelist_insert(arena, block);
+  }
+  place(arena, block, asize);
+  mark_used(arena, block);
+  harden_arm(block);
+  return PAYLOAD(block);
+}
 
-  /* your code here */
-  metadata_t* freelistIterator = freelist;
-  while(freelistIterator->next != NULL) {
-    if(GET_SIZE_H(freelistIterator) >= ALIGN(numbytes)) {
-      //If it is not worth splitting the block (need additional space for another header and footer and data) just allocate the block
-      if((GET_SIZE_H(freelistIterator) - ALIGN(numbytes)) < (METADATA_T_ALIGNED + FOOTER_T_ALIGNED + ALIGNMENT)) {
-        metadata_t* prevBlock = freelistIterator->prev;
-        metadata_t* nextBlock = freelistIterator->next;
-        prevBlock->next = nextBlock;
-        nextBlock->prev= prevBlock;
-        freelistIterator->size = PACK(GET_SIZE_H(freelistIterator), 1);
-        footer_t* freelistIteratorF = (footer_t*) ((void*) freelistIterator + METADATA_T_ALIGNED + GET_SIZE_H(freelistIterator));
-        freelistIteratorF->size = freelistIterator->size;
-        return (void*) freelistIterator + METADATA_T_ALIGNED;
+/* Like heap_alloc, but returns zeroed memory. A block that lies entirely in
+ * the clean part of the top region only needs its free-list links, and the
+ * footer it may have inherited, cleared.
+ */
+static void* heap_calloc(arena_t* arena, size_t size) {
+  size_t asize = BLOCK_SIZE(size);
+  metadata_t* block = heap_find(arena, asize);
+  if(block == NULL)
+    return NULL;
+  bool clean = (char*) block >= arena->clean_from && (char*) block < (char*) arena->top;
+  place(arena, block, asize);
+  mark_used(arena, block);
+  size_t usable = GET_SIZE_H(block) - HDR_T_ALIGNED - CANARY_SIZE;
+  if(clean) {
+    memset(PAYLOAD(block), 0, METADATA_T_ALIGNED - HDR_T_ALIGNED);
+    memset((char*) NEXT_HDR(block) - FOOTER_T_ALIGNED, 0, FOOTER_T_ALIGNED);
+  }
+  else
+    memset(PAYLOAD(block), 0, usable);
+  harden_arm(block);
+  return PAYLOAD(block);
+}
+
+/* Returns a block to the arena that owns it; callers hold the arena's lock */
+static void heap_free(arena_t* arena, void* ptr) {
+#ifdef DMM_FASTBINS
+  if(GET_SIZE_H(HDRP(ptr)) <= FASTBIN_MAX_BLOCK) {
+    fastbin_push(arena, (metadata_t*) HDRP(ptr));
+    return;
+  }
+#endif
+  metadata_t* block = coalesce(arena, (metadata_t*) HDRP(ptr));
+  freelist_insert(arena, trim_heap(arena, block));
+}
+
+/* Resizes an allocated block in place to hold an aligned payload of size
+ * bytes; callers hold the arena's lock. Shrinking splits off a free tail.
+ * Growing absorbs the free block after it, first growing the arena when the
+ * block sits at the top of its region. Returns false if the block cannot grow.
+ */
+static bool heap_resize(arena_t* arena, void* ptr, size_t size) {
+  metadata_t* block = (metadata_t*) HDRP(ptr);
+  size_t asize = BLOCK_SIZE(size);
+  size_t blockSize = GET_SIZE_H(block);
+  size_t flags = GET_H(block) & ~SIZE_MASK;
+
+  if(asize > blockSize) {
+    metadata_t* nextBlock = NEXT_HDR(block);
+    //At the top of the region the arena can grow underneath the block
+    if(nextBlock == arena->top || (GET_ALLOC_H(nextBlock) == 0 && NEXT_HDR(nextBlock) == arena->top)) {
+      size_t have = blockSize + (GET_ALLOC_H(nextBlock) ? 0 : GET_SIZE_H(nextBlock));
+      if(have < asize) {
+        metadata_t* grown = extend_heap(arena, asize - have);
+        if(grown != NULL)
+          freelist_insert(arena, grown);
       }
-      //Otherwise split
-      else {
-        metadata_t* prevBlock = freelistIterator->prev;
-        metadata_t* nextBlock = freelistIterator->next;
-        metadata_t* blockToAllocate = freelistIterator;
-        //Update footer of new block
-        footer_t* newBlockF = (footer_t*) ((void*) blockToAllocate + METADATA_T_ALIGNED + GET_SIZE_H(blockToAllocate));
-        newBlockF->size = PACK(GET_SIZE_H(blockToAllocate) - ALIGN(numbytes) - FOOTER_T_ALIGNED - METADATA_T_ALIGNED, 0);
-        //Update header of allocated block
-        blockToAllocate->size = PACK(ALIGN(numbytes), 1);
-        //Create footer of allocated block
-        footer_t* blockToAllocateF = (footer_t*) ((void*) blockToAllocate + METADATA_T_ALIGNED + GET_SIZE_H(blockToAllocate));
-        blockToAllocateF->size = blockToAllocate->size;
-        //Create header of new block
-        metadata_t* newBlock = (metadata_t*) ((void*) blockToAllocateF + FOOTER_T_ALIGNED);
-        newBlock->prev = prevBlock;
-        newBlock->next = nextBlock;
-        newBlock->size = newBlockF->size;
-        //Clean up pointers to the new block
-        prevBlock->next = newBlock;
-        nextBlock->prev = newBlock;
-        return (void*) blockToAllocate + METADATA_T_ALIGNED;
+    }
+    nextBlock = NEXT_HDR(block);
+    if(GET_ALLOC_H(nextBlock) || blockSize + GET_SIZE_H(nextBlock) < asize)
+      return false;
+    freelist_remove(arena, nextBlock);
+    blockSize += GET_SIZE_H(nextBlock);
+    block->size = blockSize | flags;
+    NEXT_HDR(block)->size |= PREV_ALLOC;
+    mark_used(arena, block);
+  }
+
+  //Give back the tail if it is worth splitting
+  if(blockSize - asize >= MIN_BLOCK) {
+    block->size = asize | flags;
+    metadata_t* tail = NEXT_HDR(block);
+    tail->size = PACK_ARENA(blockSize - asize, arena) | PREV_ALLOC;
+    heap_free(arena, PAYLOAD(tail));
+  }
+  harden_arm(block);
+  return true;
+}
+
+/* Slab front-end for tiny objects. Payloads of up to SLAB_MAX_SIZE bytes are
+ * served from SLAB_RUN_SIZE runs carved into equal slots, with no per-object
+ * header or footer. Runs come from one large zone that is reserved up front
+ * but only backed by memory as runs are handed out, so a pointer belongs to a
+ * slab exactly when it falls inside the zone, and its run is found by
+ * rounding it down to SLAB_RUN_SIZE. Each run tracks its free slots in a
+ * bitmap and belongs to the arena that carved it. If the zone cannot be
+ * reserved or runs out, tiny requests fall through to the boundary-tag heap.
+ */
+
+#define SLAB_BITMAP_WORDS ((SLAB_RUN_SIZE / ALIGNMENT + 63) / 64)
+#define SLAB_RUN(ptr) ((slab_run_t*) ((uintptr_t)(ptr) & ~((uintptr_t) SLAB_RUN_SIZE - 1)))
+#define SLAB_RUN_T_ALIGNED (ALIGN(sizeof(slab_run_t)))
+
+typedef struct slab_run {
+  struct slab_run* next;
+  struct slab_run* prev;
+  arena_t* arena;
+  unsigned int slot_size;
+  unsigned int nslots;
+  unsigned int nfree;
+  uint64_t bitmap[SLAB_BITMAP_WORDS]; //Bit set means the slot is free
+} slab_run_t;
+
+static char* slab_zone = NULL;
+static size_t slab_zone_used = 0;
+static bool slab_zone_failed = false;
+
+static bool is_slab(void* ptr) {
+  return slab_zone != NULL && (char*) ptr >= slab_zone && (char*) ptr < slab_zone + SLAB_ZONE_SIZE;
+}
+
+static void slab_push(slab_run_t** list, slab_run_t* run) {
+  run->prev = NULL;
+  run->next = *list;
+  if(*list != NULL)
+    (*list)->prev = run;
+  *list = run;
+}
+
+static void slab_unlink(slab_run_t** list, slab_run_t* run) {
+  if(run->prev != NULL)
+    run->prev->next = run->next;
+  else
+    *list = run->next;
+  if(run->next != NULL)
+    run->next->prev = run->prev;
+}
+
+/* Takes an unused run from the arena or from the zone and formats it */
+static slab_run_t* slab_new_run(arena_t* arena, size_t size) {
+  slab_run_t* run = arena->slab_empty;
+  if(run != NULL) {
+    slab_unlink(&arena->slab_empty, run);
+  }
+  else {
+    if(slab_zone == NULL) {
+      if(slab_zone_failed)
+        return NULL;
+      //Reserve the zone once; whoever loses the race gives their mapping back
+      char* mem = mmap(NULL, SLAB_ZONE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if(mem == MAP_FAILED) {
+        slab_zone_failed = true;
+        return NULL;
       }
+      if(!__sync_bool_compare_and_swap(&slab_zone, NULL, mem))
+        munmap(mem, SLAB_ZONE_SIZE);
+    }
+    size_t offset = __sync_fetch_and_add(&slab_zone_used, SLAB_RUN_SIZE);
+    if(offset + SLAB_RUN_SIZE > SLAB_ZONE_SIZE)
+      return NULL;
+    run = (slab_run_t*) (slab_zone + offset);
+  }
+
+  int i;
+  run->arena = arena;
+  run->slot_size = size;
+  run->nslots = (SLAB_RUN_SIZE - SLAB_RUN_T_ALIGNED) / size;
+  run->nfree = run->nslots;
+  for(i = 0; i < SLAB_BITMAP_WORDS; i++) {
+    unsigned int first = i * 64;
+    if(first + 64 <= run->nslots)
+      run->bitmap[i] = ~(uint64_t) 0;
+    else if(first < run->nslots)
+      run->bitmap[i] = (((uint64_t) 1) << (run->nslots - first)) - 1;
+    else
+      run->bitmap[i] = 0;
+  }
+  slab_push(&arena->slab_partial[SLAB_CLASS(size)], run);
+  return run;
+}
+
+/* Serves an aligned request of at most SLAB_MAX_SIZE bytes; callers hold the arena's lock */
+static void* slab_alloc(arena_t* arena, size_t size) {
+  slab_run_t* run = arena->slab_partial[SLAB_CLASS(size)];
+  if(run == NULL) {
+    run = slab_new_run(arena, size);
+    if(run == NULL)
+      return NULL;
+  }
+
+  int i = 0;
+  while(run->bitmap[i] == 0)
+    i++;
+  int bit = __builtin_ctzll(run->bitmap[i]);
+  run->bitmap[i] &= ~(((uint64_t) 1) << bit);
+  if(--run->nfree == 0)
+    slab_unlink(&arena->slab_partial[SLAB_CLASS(size)], run);
+  return (char*) run + SLAB_RUN_T_ALIGNED + (size_t) (i * 64 + bit) * run->slot_size;
+}
+
+/* Returns a slot to its run; callers hold the owning arena's lock. A run that
+ * becomes entirely free is kept for reuse by any slot size, unless it is the
+ * only run its size has left.
+ */
+static void slab_free(arena_t* arena, void* ptr) {
+  slab_run_t* run = SLAB_RUN(ptr);
+  slab_run_t** partial = &arena->slab_partial[SLAB_CLASS(run->slot_size)];
+  unsigned int slot = ((char*) ptr - ((char*) run + SLAB_RUN_T_ALIGNED)) / run->slot_size;
+  run->bitmap[slot / 64] |= ((uint64_t) 1) << (slot % 64);
+  if(run->nfree++ == 0)
+    slab_push(partial, run);
+  if(run->nfree == run->nslots && (*partial != run || run->next != NULL)) {
+    slab_unlink(partial, run);
+    slab_push(&arena->slab_empty, run);
+  }
+}
+
+/* Mapped blocks start their mapping on the page their header is on */
+static size_t page_size = 0;
+
+#define MAPPING_START(h) ((char*) ((uintptr_t)(h) & ~((uintptr_t) page_size - 1)))
+
+static arena_t* owner_arena(void* ptr) {
+  return is_slab(ptr) ? SLAB_RUN(ptr)->arena : GET_ARENA_H(HDRP(ptr));
+}
+
+static bool is_mmapped(void* ptr) {
+  return !is_slab(ptr) && GET_MMAPPED_H(HDRP(ptr));
+}
+
+static size_t usable_size(void* ptr) {
+  if(is_slab(ptr))
+    return SLAB_RUN(ptr)->slot_size;
+  metadata_t* block = (metadata_t*) HDRP(ptr);
+  if(GET_MMAPPED_H(block))
+    return MAPPING_START(block) + GET_SIZE_H(block) - (char*) ptr;
+  return GET_SIZE_H(block) - HDR_T_ALIGNED - CANARY_SIZE;
+}
+
+/* Usage counters behind dmm_get_stats. in_use counts the usable bytes of
+ * every block handed out by an arena or mapped directly and not yet given back;
+ * in the thread-safe build that includes blocks parked in thread caches, which
+ * keeps the counters off the cache-hit fast path. Updates from different
+ * arenas can race, so they are relaxed atomics there.
+ */
+
+#ifdef DMM_THREAD_SAFE
+#define STAT_ADD(var, n) __atomic_fetch_add(&(var), (n), __ATOMIC_RELAXED)
+#define STAT_SUB(var, n) __atomic_fetch_sub(&(var), (n), __ATOMIC_RELAXED)
+#else
+#define STAT_ADD(var, n) ((var) += (n))
+#define STAT_SUB(var, n) ((var) -= (n))
+#endif
+
+static size_t in_use_bytes = 0;
+static size_t peak_bytes = 0;
+static size_t mmap_bytes = 0;
+
+static void stats_grow(size_t bytes) {
+  size_t now = STAT_ADD(in_use_bytes, bytes) + bytes;
+  size_t peak = peak_bytes;
+  while(now > peak && !__sync_bool_compare_and_swap(&peak_bytes, peak, now))
+    peak = peak_bytes;
+}
+
+static void stats_alloc(arena_t* arena, void* ptr) {
+  size_t size = usable_size(ptr);
+  stats_grow(size);
+  STAT_ADD(arena->alloc_hist[size_class(size)], 1);
+}
+
+static void stats_free(void* ptr) {
+  STAT_SUB(in_use_bytes, usable_size(ptr));
+}
+
+/* Requests of MMAP_THRESHOLD bytes or more bypass the arenas and get a private
+ * anonymous mapping, so large transient buffers neither fragment the heap nor
+ * outlive their dfree. The header sits right before the payload as usual, with
+ * IS_MMAPPED set and the length of the whole mapping as its size; the mapping
+ * starts at the page the header is on, which leaves room to align the payload.
+ */
+
+static size_t get_page_size() {
+  if(page_size == 0)
+    page_size = sysconf(_SC_PAGESIZE);
+  return page_size;
+}
+
+static void* mmap_alloc(size_t size, size_t alignment) {
+  get_page_size();
+  size_t offset = (alignment > HDR_T_ALIGNED ? alignment : HDR_T_ALIGNED) - HDR_T_ALIGNED;
+  size_t len = (offset + HDR_T_ALIGNED + size + page_size - 1) & ~(page_size - 1);
+  char* mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(mem == MAP_FAILED)
+    return NULL;
+  metadata_t* block = (metadata_t*) (mem + offset);
+  block->size = PACK(len, 1) | IS_MMAPPED;
+  STAT_ADD(mmap_bytes, len);
+  stats_alloc(&arenas[0], PAYLOAD(block));
+  return PAYLOAD(block);
+}
+
+static void mmap_free(void* ptr) {
+  metadata_t* block = (metadata_t*) HDRP(ptr);
+  stats_free(ptr);
+  STAT_SUB(mmap_bytes, GET_SIZE_H(block));
+  munmap(MAPPING_START(block), GET_SIZE_H(block));
+}
+
+#ifdef DMM_TRACE
+/* A moving mremap gives up the old address and takes the new one in a single
+ * step, leaving no point to claim the trace record in between; the caller
+ * copies instead.
+ */
+#define MREMAP_FLAGS 0
+#else
+#define MREMAP_FLAGS MREMAP_MAYMOVE
+#endif
+
+/* Resizes the mapping with mremap, which may move it. Returns NULL if it
+ * cannot, and the caller has to move the data.
+ */
+static void* mmap_resize(void* ptr, size_t size) {
+  metadata_t* block = (metadata_t*) HDRP(ptr);
+  char* start = MAPPING_START(block);
+  size_t offset = (char*) block - start;
+  size_t len = (offset + HDR_T_ALIGNED + size + page_size - 1) & ~(page_size - 1);
+  if(len == GET_SIZE_H(block))
+    return ptr;
+  size_t oldLen = GET_SIZE_H(block);
+  char* mem = mremap(start, oldLen, len, MREMAP_FLAGS);
+  if(mem == MAP_FAILED)
+    return NULL;
+  if(len > oldLen)
+    stats_grow(len - oldLen);
+  else
+    STAT_SUB(in_use_bytes, oldLen - len);
+  STAT_ADD(mmap_bytes, len - oldLen); //Wraps around correctly when shrinking
+  block = (metadata_t*) (mem + offset);
+  block->size = PACK(len, 1) | IS_MMAPPED;
+  return PAYLOAD(block);
+}
+
+/* Entry points shared by dmalloc, dfree and the thread caches: route a request
+ * to the slab or the boundary-tag heap. Callers hold the arena's lock.
+ */
+static void* arena_alloc(arena_t* arena, size_t size) {
+  void* ptr = NULL;
+  if(size <= SLAB_MAX_SIZE)
+    ptr = slab_alloc(arena, size);
+  if(ptr == NULL)
+    ptr = heap_alloc(arena, size);
+  if(ptr != NULL)
+    stats_alloc(arena, ptr);
+  return ptr;
+}
+
+#ifdef DMM_HARDENED
+/* Hardened-mode checks. Every dfree and drealloc validates its pointer before
+ * touching any bookkeeping: it must be aligned, a slab slot must lie on a slot
+ * boundary and still be allocated, and a heap block must have its alloc bit
+ * set and an intact canary. Freed heap blocks wait in a per-arena FIFO of
+ * QUARANTINE_BLOCKS entries with their first QUARANTINE_POISON bytes poisoned
+ * before they rejoin the free lists, which catches writes after free on
+ * eviction and keeps recently freed memory from being handed out again at
+ * once. Problems abort the process with a message on stderr.
+ */
+
+#define POISON_BYTE 0xdf
+
+static int arena_check(arena_t* arena);
+
+static void harden_abort(const char* what, void* ptr) {
+  char msg[128];
+  int len = snprintf(msg, sizeof(msg), "dmm: %s (%p)\n", what, ptr);
+  if(write(STDERR_FILENO, msg, len) < 0)
+    len = 0;
+  abort();
+}
+
+static void harden_check_free(void* ptr) {
+  if(ptr == NULL || ((uintptr_t) ptr & (ALIGNMENT - 1)) != 0)
+    harden_abort("free of an invalid pointer", ptr);
+  if(is_slab(ptr)) {
+    slab_run_t* run = SLAB_RUN(ptr);
+    char* first = (char*) run + SLAB_RUN_T_ALIGNED;
+    if(run->arena < arenas || run->arena >= arenas + NUM_ARENAS || run->slot_size == 0
+        || (char*) ptr < first || ((char*) ptr - first) % run->slot_size != 0
+        || ((char*) ptr - first) / run->slot_size >= run->nslots)
+      harden_abort("free of an invalid pointer", ptr);
+    unsigned int slot = ((char*) ptr - first) / run->slot_size;
+    if(run->bitmap[slot / 64] & (((uint64_t) 1) << (slot % 64)))
+      harden_abort("double free", ptr);
+    return;
+  }
+  metadata_t* block = (metadata_t*) HDRP(ptr);
+  if(GET_MMAPPED_H(block)) {
+    if(!GET_ALLOC_H(block) || GET_SIZE_H(block) % get_page_size() != 0)
+      harden_abort("free of an invalid pointer", ptr);
+    return;
+  }
+  if(!GET_ALLOC_H(block))
+    harden_abort("double free or invalid pointer", ptr);
+  if((GET_H(block) >> ARENA_SHIFT) >= NUM_ARENAS || GET_SIZE_H(block) < MIN_BLOCK)
+    harden_abort("free of an invalid pointer", ptr);
+  if(*CANARY_SLOT(block) == QUARANTINE_CANARY(block))
+    harden_abort("double free", ptr);
+  if(*CANARY_SLOT(block) != CANARY(block))
+    harden_abort("heap overflow: canary damaged", ptr);
+}
+
+/* Poisons a freed heap block and swaps it for the oldest one in quarantine,
+ * which is checked and really freed.
+ */
+static void quarantine_push(arena_t* arena, void* ptr) {
+  metadata_t* block = (metadata_t*) HDRP(ptr);
+  size_t usable = GET_SIZE_H(block) - HDR_T_ALIGNED - CANARY_SIZE;
+  memset(ptr, POISON_BYTE, usable < QUARANTINE_POISON ? usable : QUARANTINE_POISON);
+  *CANARY_SLOT(block) = QUARANTINE_CANARY(block);
+
+  void* oldest = arena->quarantine[arena->quarantine_next];
+  arena->quarantine[arena->quarantine_next] = ptr;
+  arena->quarantine_next = (arena->quarantine_next + 1) % QUARANTINE_BLOCKS;
+  if(oldest == NULL)
+    return;
+  block = (metadata_t*) HDRP(oldest);
+  usable = GET_SIZE_H(block) - HDR_T_ALIGNED - CANARY_SIZE;
+  size_t i;
+  for(i = 0; i < usable && i < QUARANTINE_POISON; i++) {
+    if(((unsigned char*) oldest)[i] != POISON_BYTE)
+      harden_abort("write after free", oldest);
+  }
+  if(*CANARY_SLOT(block) != QUARANTINE_CANARY(block))
+    harden_abort("heap overflow into a freed block", oldest);
+  heap_free(arena, oldest);
+}
+#endif
+
+static void arena_free(arena_t* arena, void* ptr) {
+  stats_free(ptr);
+  if(is_slab(ptr))
+    slab_free(arena, ptr);
+  else {
+#ifdef DMM_HARDENED
+    quarantine_push(arena, ptr);
+#else
+    heap_free(arena, ptr);
+#endif
+  }
+#ifdef DMM_HARDENED
+  //Sampled full check, so the cost is spread thinly over many frees
+  if(++arena->frees_since_check >= HARDEN_CHECK_INTERVAL) {
+    arena->frees_since_check = 0;
+    if(arena_check(arena) != 0)
+      harden_abort("heap check failed", arena);
+  }
+#endif
+}
+
+
+#ifdef DMM_THREAD_SAFE
+/* Threads are spread over the arenas round-robin the first time they
+ * allocate; build with -DDMM_ARENA_BY_CPU to pick the arena of the CPU the
+ * thread is currently running on instead.
+ */
+#ifdef DMM_ARENA_BY_CPU
+static arena_t* thread_arena() {
+  int cpu = sched_getcpu();
+  return &arenas[(cpu < 0 ? 0 : cpu) % NUM_ARENAS];
+}
+#else
+static __thread arena_t* thread_arena_cache = NULL;
+static unsigned int next_arena = 0;
+
+static arena_t* thread_arena() {
+  if(thread_arena_cache == NULL)
+    thread_arena_cache = &arenas[__sync_fetch_and_add(&next_arena, 1) % NUM_ARENAS];
+  return thread_arena_cache;
+}
+#endif
+#else
+#define thread_arena() (&arenas[0])
+#endif
+
+#ifdef DMM_TCACHE
+/* Per-thread cache of small blocks, one LIFO bin per aligned payload size.
+ * Cached blocks stay marked allocated in their arena and are chained through
+ * their first payload word, so a hit touches no shared state. Misses refill a
+ * bin with TCACHE_BATCH blocks from the thread's arena under a single lock
+ * acquisition, and a bin that reaches TCACHE_BIN_MAX flushes half of itself
+ * back to the owning arenas. The thread's bins are flushed entirely when it
+ * exits.
+ */
+
+#define TCACHE_BINS (TCACHE_MAX_SIZE / ALIGNMENT)
+#define TCACHE_BIN(size) ((size) / ALIGNMENT - 1)
+
+typedef struct tcache {
+  void* bins[TCACHE_BINS];
+  unsigned int count[TCACHE_BINS];
+  bool registered;
+} tcache_t;
+
+static __thread tcache_t tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+static void tcache_flush(tcache_t* cache, int bin, unsigned int n) {
+  arena_t* locked = NULL;
+  while(n-- > 0 && cache->bins[bin] != NULL) {
+    void* ptr = cache->bins[bin];
+    cache->bins[bin] = *(void**) ptr;
+    cache->count[bin]--;
+    //Blocks from the same arena are usually adjacent in the bin, so only switch locks when the owner changes
+    arena_t* arena = owner_arena(ptr);
+    if(arena != locked) {
+      if(locked != NULL)
+        ARENA_UNLOCK(locked);
+      ARENA_LOCK(arena);
+      locked = arena;
     }
-    freelistIterator = freelistIterator->next;
+    arena_free(arena, ptr);
+  }
+  if(locked != NULL)
+    ARENA_UNLOCK(locked);
+}
+
+static void tcache_destroy(void* arg) {
+  tcache_t* cache = arg;
+  int bin;
+  for(bin = 0; bin < TCACHE_BINS; bin++)
+    tcache_flush(cache, bin, cache->count[bin]);
+}
+
+static void tcache_create_key() {
+  pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+static void tcache_refill(int bin, size_t size) {
+  arena_t* arena = thread_arena();
+  int i;
+  if(!tcache.registered) {
+    //Registering the cache is what makes tcache_destroy run at thread exit
+    //Set the flag first: pthread_setspecific may allocate, which must not recurse back here
+    tcache.registered = true;
+    pthread_once(&tcache_once, tcache_create_key);
+    pthread_setspecific(tcache_key, &tcache);
+  }
+  ARENA_LOCK(arena);
+  for(i = 0; i < TCACHE_BATCH; i++) {
+    void* ptr = arena_alloc(arena, size);
+    if(ptr == NULL)
+      break;
+    *(void**) ptr = tcache.bins[bin];
+    tcache.bins[bin] = ptr;
+    tcache.count[bin]++;
+  }
+  ARENA_UNLOCK(arena);
+}
+
+static void* tcache_alloc(size_t size) {
+  int bin = TCACHE_BIN(size);
+  if(tcache.bins[bin] == NULL) {
+    tcache_refill(bin, size);
+    if(tcache.bins[bin] == NULL)
+      return NULL;
+  }
+  void* ptr = tcache.bins[bin];
+  tcache.bins[bin] = *(void**) ptr;
+  tcache.count[bin]--;
+  return ptr;
+}
+
+static void tcache_free(void* ptr, size_t size) {
+  int bin = TCACHE_BIN(size);
+  if(tcache.count[bin] >= TCACHE_BIN_MAX)
+    tcache_flush(&tcache, bin, TCACHE_BIN_MAX / 2);
+  *(void**) ptr = tcache.bins[bin];
+  tcache.bins[bin] = ptr;
+  tcache.count[bin]++;
+}
+#endif
+
+#ifdef DMM_PROFILE
+/* Sampling heap profiler. Each thread counts down the bytes it allocates and
+ * records the caller of every allocation that crosses a PROFILE_SAMPLE_BYTES
+ * boundary, so a site's sample count times the interval estimates how much it
+ * allocates. Sites live in a small open-addressing table keyed by return
+ * address; resolve them with addr2line.
+ */
+
+typedef struct profile_site {
+  void* site;
+  size_t samples;
+  size_t bytes;
+} profile_site_t;
+
+static profile_site_t profile_sites[PROFILE_SITES];
+static __thread long profile_countdown = PROFILE_SAMPLE_BYTES;
+
+#ifdef DMM_THREAD_SAFE
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+#define PROFILE_LOCK() pthread_mutex_lock(&profile_lock)
+#define PROFILE_UNLOCK() pthread_mutex_unlock(&profile_lock)
+#else
+#define PROFILE_LOCK()
+#define PROFILE_UNLOCK()
+#endif
+
+static void profile_sample(void* site, size_t size) {
+  size_t i, probe;
+  profile_countdown += PROFILE_SAMPLE_BYTES;
+  PROFILE_LOCK();
+  i = ((uintptr_t) site >> 4) % PROFILE_SITES;
+  for(probe = 0; probe < PROFILE_SITES; probe++, i = (i + 1) % PROFILE_SITES) {
+    if(profile_sites[i].site == site || profile_sites[i].site == NULL) {
+      profile_sites[i].site = site;
+      profile_sites[i].samples++;
+      profile_sites[i].bytes += size;
+      break;
+    }
+  }
+  PROFILE_UNLOCK();
+}
+
+#define PROFILE(size) do { \
+    if((profile_countdown -= (long) (size)) <= 0) \
+      profile_sample(__builtin_return_address(0), size); \
+  } while(0)
+#else
+#define PROFILE(size)
+#endif
+
+#ifdef DMM_TRACE
+/* Allocation recorder. Every public call appends a dmm_trace_rec_t to a
+ * shared ring of TRACE_RING_RECORDS entries: a thread claims a slot by
+ * advancing ring_head, fills it in and then publishes it by storing the lap
+ * number in ring_ready. A background thread drains published records to the
+ * file named by DMM_TRACE_FILE every TRACE_FLUSH_MS, and once more at exit.
+ * Recording never blocks; when the writer falls a whole ring behind, records
+ * are dropped and counted instead.
+ *
+ * The ring order is what mdriver replays, so a call that gives memory back
+ * claims its slot before the memory can be handed out again (TRACE_CLAIM),
+ * and a call that obtains memory claims it afterwards. Another thread that
+ * gets the same address then always records it after the release.
+ */
+
+static dmm_trace_rec_t ring[TRACE_RING_RECORDS];
+static uint32_t ring_ready[TRACE_RING_RECORDS];
+static volatile uint64_t ring_head = 0;
+static volatile uint64_t ring_tail = 0;
+static uint64_t trace_dropped = 0;
+static uint64_t trace_start_ns;
+static int trace_fd = -1;
+static bool trace_off = false;
+static uint16_t trace_threads = 0;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t trace_drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread uint16_t trace_tid = 0;
+static __thread bool in_trace = false;
+static __thread bool trace_claimed = false;
+static __thread uint64_t trace_slot; //Claimed ring index, or UINT64_MAX if dropped
+
+static uint64_t trace_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void trace_write(const void* buf, size_t len) {
+  while(len > 0) {
+    ssize_t n = write(trace_fd, buf, len);
+    if(n <= 0) {
+      if(n < 0 && errno == EINTR)
+        continue;
+      trace_off = true;
+      return;
+    }
+    buf = (const char*) buf + n;
+    len -= n;
+  }
+}
+
+static void trace_drain() {
+  pthread_mutex_lock(&trace_drain_lock);
+  uint64_t tail = ring_tail;
+  for(;;) {
+    //Write the run of published records up to the end of the ring
+    uint64_t n = 0;
+    while((tail + n) % TRACE_RING_RECORDS != 0 || n == 0) {
+      uint64_t idx = tail + n;
+      if(__atomic_load_n(&ring_ready[idx % TRACE_RING_RECORDS], __ATOMIC_ACQUIRE) != idx / TRACE_RING_RECORDS + 1)
+        break;
+      n++;
+    }
+    if(n == 0)
+      break;
+    if(trace_fd >= 0)
+      trace_write(&ring[tail % TRACE_RING_RECORDS], n * sizeof(dmm_trace_rec_t));
+    tail += n;
+    __atomic_store_n(&ring_tail, tail, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&trace_drain_lock);
+}
+
+static void* trace_writer(void* arg) {
+  struct timespec delay = { 0, TRACE_FLUSH_MS * 1000000L };
+  in_trace = true;
+  for(;;) {
+    nanosleep(&delay, NULL);
+    trace_drain();
   }
-  
   return NULL;
 }
 
+static void trace_finish() {
+  trace_drain();
+  if(trace_dropped != 0)
+    fprintf(stderr, "dmm: trace dropped %lu records\n", (unsigned long) trace_dropped);
+}
+
+static void trace_start() {
+  const char* path = getenv("DMM_TRACE_FILE");
+  dmm_trace_header_t header = { DMM_TRACE_MAGIC, DMM_TRACE_VERSION, sizeof(dmm_trace_rec_t) };
+  pthread_t writer;
+  pthread_attr_t attr;
+
+  trace_start_ns = trace_now();
+  trace_fd = open(path ? path : "dmm.trace", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if(trace_fd < 0) {
+    trace_off = true;
+    return;
+  }
+  trace_write(&header, sizeof(header));
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  if(pthread_create(&writer, &attr, trace_writer, NULL) != 0)
+    trace_off = true;
+  pthread_attr_destroy(&attr);
+  atexit(trace_finish);
+}
+
+/* Claims the calling thread's next ring slot now, for the record written by
+ * the following trace_record.
+ */
+static void trace_claim() {
+  //Starting the writer thread can allocate; those calls are not recorded
+  if(trace_off || in_trace || trace_claimed)
+    return;
+  in_trace = true;
+  pthread_once(&trace_once, trace_start);
+  in_trace = false;
+  if(trace_off)
+    return;
+  if(trace_tid == 0)
+    trace_tid = __sync_add_and_fetch(&trace_threads, 1);
+
+  uint64_t idx;
+  do {
+    idx = ring_head;
+    if(idx - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) >= TRACE_RING_RECORDS) {
+      __sync_fetch_and_add(&trace_dropped, 1);
+      idx = UINT64_MAX;
+      break;
+    }
+  } while(!__sync_bool_compare_and_swap(&ring_head, idx, idx + 1));
+  trace_slot = idx;
+  trace_claimed = true;
+}
+
+static void trace_record(uint8_t op, void* ptr, void* oldPtr, size_t size) {
+  trace_claim();
+  if(!trace_claimed)
+    return;
+  trace_claimed = false;
+  uint64_t idx = trace_slot;
+  if(idx == UINT64_MAX)
+    return;
+
+  dmm_trace_rec_t* rec = &ring[idx % TRACE_RING_RECORDS];
+  rec->time_ns = trace_now() - trace_start_ns;
+  rec->ptr = (uintptr_t) ptr;
+  rec->old_ptr = (uintptr_t) oldPtr;
+  rec->size = size > UINT32_MAX ? UINT32_MAX : size;
+  rec->thread = trace_tid;
+  rec->op = op;
+  rec->pad = 0;
+  __atomic_store_n(&ring_ready[idx % TRACE_RING_RECORDS], (uint32_t) (idx / TRACE_RING_RECORDS + 1), __ATOMIC_RELEASE);
+}
+
+#define TRACE(op, ptr, oldPtr, size) trace_record(op, ptr, oldPtr, size)
+#define TRACE_CLAIM() trace_claim()
+#else
+#define TRACE(op, ptr, oldPtr, size)
+#define TRACE_CLAIM()
+#endif
+
+static void* do_malloc(size_t numbytes) {
+  //dmalloc(0) still gets the smallest block when asserts are compiled out
+  size_t size = numbytes == 0 ? ALIGNMENT : ALIGN(numbytes);
+#ifdef DMM_TCACHE
+  if(size <= TCACHE_MAX_SIZE)
+    return tcache_alloc(size);
+#endif
+  if(size >= MMAP_THRESHOLD)
+    return mmap_alloc(size, ALIGNMENT);
+  arena_t* arena = thread_arena();
+  ARENA_LOCK(arena);
+  void* ptr = arena_alloc(arena, size);
+  ARENA_UNLOCK(arena);
+  return ptr;
+}
+
+static void do_free(void* ptr) {
+#ifdef DMM_HARDENED
+  harden_check_free(ptr);
+#endif
+  if(is_mmapped(ptr)) {
+    mmap_free(ptr);
+    return;
+  }
+#ifdef DMM_TCACHE
+  size_t size = usable_size(ptr);
+  if(size <= TCACHE_MAX_SIZE) {
+    tcache_free(ptr, size);
+    return;
+  }
+#endif
+  arena_t* arena = owner_arena(ptr);
+  ARENA_LOCK(arena);
+  arena_free(arena, ptr);
+  ARENA_UNLOCK(arena);
+}
+
+static void* do_realloc(void* ptr, size_t numbytes) {
+  if(ptr == NULL)
+    return do_malloc(numbytes);
+  if(numbytes == 0) {
+    TRACE_CLAIM();
+    do_free(ptr);
+    return NULL;
+  }
+#ifdef DMM_HARDENED
+  harden_check_free(ptr);
+#endif
+
+  size_t size = ALIGN(numbytes);
+  size_t oldSize = usable_size(ptr);
+  if(is_slab(ptr)) {
+    if(size <= oldSize)
+      return ptr;
+  }
+  else if(is_mmapped(ptr)) {
+    //Stay mapped while the buffer is large; mremap avoids copying the pages
+    if(size >= MMAP_THRESHOLD) {
+      void* newPtr = mmap_resize(ptr, size);
+      if(newPtr != NULL)
+        return newPtr;
+    }
+  }
+  else {
+    arena_t* arena = owner_arena(ptr);
+    ARENA_LOCK(arena);
+    bool resized = heap_resize(arena, ptr, size);
+    if(resized) {
+      size_t newSize = usable_size(ptr);
+      if(newSize > oldSize)
+        stats_grow(newSize - oldSize);
+      else
+        STAT_SUB(in_use_bytes, oldSize - newSize);
+    }
+    ARENA_UNLOCK(arena);
+    if(resized)
+      return ptr;
+  }
+
+  //Could not resize in place: move the data
+  void* newPtr = do_malloc(numbytes);
+  if(newPtr == NULL)
+    return NULL;
+  memcpy(newPtr, ptr, oldSize < size ? oldSize : size);
+  //Recorded between getting the new block and releasing the old one
+  TRACE_CLAIM();
+  do_free(ptr);
+  return newPtr;
+}
+
+static void* do_calloc(size_t nmemb, size_t numbytes) {
+  size_t size = ALIGN(nmemb * numbytes);
+  //Cached and slab blocks are recycled too often to be worth tracking
+  size_t small = SLAB_MAX_SIZE;
+#ifdef DMM_TCACHE
+  small = TCACHE_MAX_SIZE;
+#endif
+  if(size <= small) {
+    void* ptr = do_malloc(size);
+    if(ptr != NULL)
+      memset(ptr, 0, size);
+    return ptr;
+  }
+  //Fresh mappings are already zero
+  if(size >= MMAP_THRESHOLD)
+    return mmap_alloc(size, ALIGNMENT);
+  arena_t* arena = thread_arena();
+  ARENA_LOCK(arena);
+  void* ptr = heap_calloc(arena, size);
+  if(ptr != NULL)
+    stats_alloc(arena, ptr);
+  ARENA_UNLOCK(arena);
+  return ptr;
+}
+
+static void* do_aligned_alloc(size_t alignment, size_t numbytes) {
+  if(alignment <= ALIGNMENT)
+    return do_malloc(numbytes);
+  size_t size = ALIGN(numbytes);
+  if(size >= MMAP_THRESHOLD && alignment <= get_page_size())
+    return mmap_alloc(size, alignment);
+  //Slab slots and cached blocks have no particular alignment, so always go to the heap
+  arena_t* arena = thread_arena();
+  ARENA_LOCK(arena);
+  void* ptr = heap_aligned_alloc(arena, alignment, size);
+  if(ptr != NULL)
+    stats_alloc(arena, ptr);
+  ARENA_UNLOCK(arena);
+  return ptr;
+}
+
+/* The public entry points do the argument checks, sampling and recording;
+ * the do_ functions above them are what they share internally, so a realloc
+ * that moves its block is profiled and traced once.
+ */
+
+/* Fails requests that are too large to ever satisfy */
+static bool too_large(size_t numbytes) {
+  if(numbytes <= MAX_REQUEST_SIZE)
+    return false;
+  errno = ENOMEM;
+  return true;
+}
+
+void* dmalloc(size_t numbytes) {
+  assert(numbytes > 0);
+  if(too_large(numbytes))
+    return NULL;
+  PROFILE(numbytes);
+  void* ptr = do_malloc(numbytes);
+  TRACE(DMM_TRACE_ALLOC, ptr, NULL, numbytes);
+  return ptr;
+}
+
 void dfree(void* ptr) {
-  /* your code here */
-  int before, after;
-  metadata_t* block = (metadata_t*) HDRP(ptr);
-  footer_t* blockF = (footer_t*) FTRP(ptr);
-  before = GET_ALLOC_F((void*) block - FOOTER_T_ALIGNED);
-  after = GET_ALLOC_H((void*) blockF + FOOTER_T_ALIGNED);
-
-  //Case 1: prev and next are both allocated
-  if((before == 1) && (after == 1)) {
-    metadata_t* freelistIterator = freelist;
-    while(freelistIterator->next != NULL) {
-      if((freelistIterator < block) && (freelistIterator->next > block)) {
-        block->prev = freelistIterator;
-        block->next = freelistIterator->next;  
-        freelistIterator->next->prev = block;      
-        freelistIterator->next = block;
-        block->size = PACK(GET_SIZE_H(block), 0);
-        blockF->size = PACK(GET_SIZE_H(block), 0);
-        return;
+  TRACE_CLAIM();
+  do_free(ptr);
+  TRACE(DMM_TRACE_FREE, ptr, NULL, 0);
+}
+
+void* drealloc(void* ptr, size_t numbytes) {
+  if(too_large(numbytes))
+    return NULL;
+  if(numbytes != 0)
+    PROFILE(numbytes);
+  void* newPtr = do_realloc(ptr, numbytes);
+  TRACE(DMM_TRACE_REALLOC, newPtr, ptr, numbytes);
+  return newPtr;
+}
+
+void* dcalloc(size_t nmemb, size_t numbytes) {
+  if(nmemb == 0 || numbytes == 0)
+    return NULL;
+  if(nmemb > (size_t) -1 / numbytes || too_large(nmemb * numbytes))
+    return NULL;
+  PROFILE(nmemb * numbytes);
+  void* ptr = do_calloc(nmemb, numbytes);
+  TRACE(DMM_TRACE_ALLOC, ptr, NULL, nmemb * numbytes);
+  return ptr;
+}
+
+void* daligned_alloc(size_t alignment, size_t numbytes) {
+  if(numbytes == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0)
+    return NULL;
+  //Each is at most MAX_REQUEST_SIZE before they are added
+  if(too_large(alignment) || too_large(numbytes) || too_large(numbytes + alignment))
+    return NULL;
+  PROFILE(numbytes);
+  void* ptr = do_aligned_alloc(alignment, numbytes);
+  TRACE(DMM_TRACE_ALLOC, ptr, NULL, numbytes);
+  return ptr;
+}
+
+int dposix_memalign(void** memptr, size_t alignment, size_t numbytes) {
+  if(alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+  if(numbytes == 0) {
+    *memptr = NULL;
+    return 0;
+  }
+  void* ptr = daligned_alloc(alignment, numbytes);
+  if(ptr == NULL)
+    return ENOMEM;
+  *memptr = ptr;
+  return 0;
+}
+
+size_t dmalloc_usable_size(void* ptr) {
+  return ptr == NULL ? 0 : usable_size(ptr);
+}
+
+#ifdef DMM_THREAD_SAFE
+/* A child forked while another thread holds an arena lock would inherit the
+ * lock held forever. Take every allocator lock around fork so the heap is
+ * quiescent, then reinitialize them in the child.
+ */
+
+void dmm_fork_prepare() {
+  int a;
+  for(a = 0; a < NUM_ARENAS; a++)
+    ARENA_LOCK(&arenas[a]);
+#ifdef DMM_PROFILE
+  PROFILE_LOCK();
+#endif
+}
+
+void dmm_fork_parent() {
+  int a;
+#ifdef DMM_PROFILE
+  PROFILE_UNLOCK();
+#endif
+  for(a = NUM_ARENAS - 1; a >= 0; a--)
+    ARENA_UNLOCK(&arenas[a]);
+}
+
+void dmm_fork_child() {
+  int a;
+#ifdef DMM_TRACE
+  //The writer thread does not survive fork, so the child would only fill the ring
+  trace_off = true;
+#endif
+#ifdef DMM_PROFILE
+  pthread_mutex_init(&profile_lock, NULL);
+#endif
+  for(a = 0; a < NUM_ARENAS; a++)
+    pthread_mutex_init(&arenas[a].lock, NULL);
+}
+#else
+void dmm_fork_prepare() {}
+void dmm_fork_parent() {}
+void dmm_fork_child() {}
+#endif
+
+static bool heap_init(arena_t* arena) {
+
+  /* Each region of the heap is framed by an allocated header-only prologue
+   * block and an allocated zero-size epilogue header, so coalescing never has to
+   * special-case the first or last block. Every arena starts out with
+   * INITIAL_HEAP_SIZE bytes and grows on demand.
+   */
+
+#ifdef DMM_HARDENED
+  //AT_RANDOM is the same 16 bytes for every caller, so racing arenas agree on the secret
+  //The bytes need not be aligned, so copy them out
+  if(canary_secret == 0) {
+    uintptr_t secret;
+    memcpy(&secret, (void*) getauxval(AT_RANDOM), sizeof(secret));
+    canary_secret = secret | 1;
+  }
+#endif
+  metadata_t* firstBlock = extend_heap(arena, INITIAL_HEAP_SIZE - REGION_OVERHEAD);
+  if(firstBlock == NULL)
+    return false;
+  freelist_insert(arena, firstBlock);
+  arena->initialized = true;
+  return true;
+}
+
+bool dmalloc_init() {
+  arena_t* arena = thread_arena();
+  ARENA_LOCK(arena);
+  bool ok = arena->initialized || heap_init(arena);
+  ARENA_UNLOCK(arena);
+  return ok;
+}
+
+/* Walks every region of an arena block by block, then its free lists and
+ * slab runs, checking the invariants the allocator relies on. Each problem is
+ * reported on stderr; returns how many were found. Callers hold the arena's
+ * lock.
+ */
+
+#define CHECK(cond, ...) do { \
+    if(!(cond)) { \
+      errors++; \
+      fprintf(stderr, "dmm_check_heap: arena %d: ", (int) (arena - arenas)); \
+      fprintf(stderr, __VA_ARGS__); \
+      fputc('\n', stderr); \
+    } \
+  } while(0)
+
+/* Checks the subtree at node against the key bounds its ancestors impose and
+ * the treap priorities; returns how many nodes it holds, giving up past limit.
+ */
+static size_t tree_check(arena_t* arena, tree_node_t* node, tree_node_t* low, tree_node_t* high, size_t limit, int* errorCount) {
+  int errors = 0;
+  size_t count = 0;
+  int dir;
+  if(node == NULL || limit == 0)
+    return 0;
+  CHECK(!GET_ALLOC_H(node), "block %p in the tree is marked allocated", (void*) node);
+  CHECK(GET_SIZE_H(node) >= TREE_MIN_SIZE, "block %p of size %zu is in the tree", (void*) node, GET_SIZE_H(node));
+  CHECK((low == NULL || tree_less(low, node)) && (high == NULL || tree_less(node, high)), "tree node %p is out of order", (void*) node);
+  for(dir = 0; dir < 2; dir++) {
+    tree_node_t* child = node->child[dir];
+    if(child == NULL)
+      continue;
+    if(count + 1 >= limit)
+      break;
+    CHECK(TREE_PRIORITY(child) <= TREE_PRIORITY(node), "tree node %p has a higher priority than its parent", (void*) child);
+    CHECK(child->parent == node, "tree node %p does not link back to its parent", (void*) child);
+    count += tree_check(arena, child, dir ? node : low, dir ? high : node, limit - 1 - count, &errors);
+  }
+  *errorCount += errors;
+  return count + 1;
+}
+
+static int arena_check(arena_t* arena) {
+  int errors = 0, idx;
+  size_t walkedFree = 0, listedFree = 0;
+  metadata_t* region;
+  metadata_t* block;
+
+  if(!arena->initialized)
+    return 0;
+  for(region = arena->regions; region != NULL; region = region->next) {
+    if(GET_H(region) != (PACK(PROLOGUE_SIZE, 1) | PREV_ALLOC)) {
+      CHECK(false, "region %p has a damaged prologue", (void*) region);
+      break;
+    }
+    size_t prevAlloc = PREV_ALLOC;
+    for(block = NEXT_HDR(region); GET_SIZE_H(block) != 0; block = NEXT_HDR(block)) {
+      size_t size = GET_SIZE_H(block);
+      if(size < MIN_BLOCK || size % ALIGNMENT != 0) {
+        CHECK(false, "block %p has a bad size %zu", (void*) block, size);
+        break;
       }
-      freelistIterator = freelistIterator->next;
+      CHECK(GET_PREV_ALLOC_H(block) == prevAlloc, "block %p has the wrong PREV_ALLOC bit", (void*) block);
+      if(GET_ALLOC_H(block)) {
+        CHECK(GET_ARENA_H(block) == arena, "allocated block %p is tagged with another arena", (void*) block);
+#ifdef DMM_HARDENED
+        CHECK(*CANARY_SLOT(block) == CANARY(block) || *CANARY_SLOT(block) == QUARANTINE_CANARY(block),
+          "allocated block %p has a damaged canary", (void*) block);
+#endif
+        prevAlloc = PREV_ALLOC;
+      }
+      else {
+        CHECK(BLOCK_FTR(block)->size == block->size, "free block %p has a footer that does not match its header", (void*) block);
+        CHECK(prevAlloc, "free block %p follows another free block", (void*) block);
+        walkedFree++;
+        prevAlloc = 0;
+      }
+    }
+    if(GET_SIZE_H(block) == 0) {
+      CHECK(GET_ALLOC_H(block), "region %p has a free epilogue", (void*) region);
+      CHECK(GET_PREV_ALLOC_H(block) == prevAlloc, "epilogue %p has the wrong PREV_ALLOC bit", (void*) block);
+      CHECK(region != arena->regions || block == arena->top, "the newest region does not end at top");
     }
   }
-  //Case 2: prev is allocated but next is free
-  else if((before == 1) && (after == 0)) {
-    metadata_t* freelistIterator = freelist;
-    while(freelistIterator->next != NULL) {
-      if((freelistIterator < block) && (freelistIterator->next > block)) {
-        metadata_t* curNext = freelistIterator->next;
-        metadata_t* newNext = freelistIterator->next->next;
-        size_t newSize = GET_SIZE_H(block) + GET_SIZE_H((void*) blockF + FOOTER_T_ALIGNED) + METADATA_T_ALIGNED + FOOTER_T_ALIGNED;
-        block->size = PACK(newSize, 0);
-        footer_t* nextF = (footer_t*) ((void*) curNext + METADATA_T_ALIGNED + GET_SIZE_H(curNext));
-        nextF->size = block->size;
-        freelistIterator->next = block;
-        block->prev = freelistIterator;
-        block->next = newNext;
-        newNext->prev = block;
-        return;
+
+  for(idx = 0; idx < NUM_SIZE_CLASSES; idx++) {
+    metadata_t* prevBlock = NULL;
+    size_t steps = 0;
+    CHECK(((arena->nonempty >> idx) & 1) == (arena->freelist[idx] != NULL), "nonempty bit %d is wrong", idx);
+    for(block = arena->freelist[idx]; block != NULL; prevBlock = block, block = block->next) {
+      if(++steps > walkedFree) {
+        CHECK(false, "free list %d holds more blocks than the heap has free, or loops", idx);
+        break;
       }
-      freelistIterator = freelistIterator->next;
+      CHECK(block->prev == prevBlock, "free block %p links back to %p instead of %p", (void*) block, (void*) block->prev, (void*) prevBlock);
+      CHECK(!GET_ALLOC_H(block), "block %p on free list %d is marked allocated", (void*) block, idx);
+      CHECK(size_class(GET_SIZE_H(block)) == idx, "block %p of size %zu is on free list %d", (void*) block, GET_SIZE_H(block), idx);
+      listedFree++;
     }
   }
-  //Case 3: prev is free but next is allocated
-  else if((before == 0) && (after == 1)) {
-    metadata_t* freelistIterator = freelist;
-    while(freelistIterator->next != NULL) {
-      if((freelistIterator < block) && (freelistIterator->next > block)) {
-        size_t newSize = GET_SIZE_H(block) + GET_SIZE_F((void*) block - FOOTER_T_ALIGNED) + METADATA_T_ALIGNED + FOOTER_T_ALIGNED;
-        freelistIterator->size = PACK(newSize, 0);
-        blockF->size = PACK(newSize, 0);
-        return;
+  CHECK(arena->tree == NULL || arena->tree->parent == NULL, "the tree root has a parent");
+  listedFree += tree_check(arena, arena->tree, NULL, NULL, walkedFree + 1, &errors);
+  if(arena->wild != NULL) {
+    CHECK(!GET_ALLOC_H(arena->wild) && NEXT_HDR(arena->wild) == arena->top, "wild block %p is not a free block ending at top", (void*) arena->wild);
+    listedFree++;
+  }
+  CHECK(listedFree == walkedFree, "%zu free blocks in the heap but %zu on the free lists", walkedFree, listedFree);
+
+#ifdef DMM_FASTBINS
+  size_t parked = 0;
+  for(idx = 0; idx < FASTBINS; idx++) {
+    for(block = arena->fastbin[idx]; block != NULL; block = block->next) {
+      if(++parked > arena->fast_count) {
+        CHECK(false, "fast bins hold more blocks than fast_count, or loop");
+        break;
       }
-      freelistIterator = freelistIterator->next;
+      CHECK(GET_ALLOC_H(block), "parked block %p is not marked allocated", (void*) block);
+      CHECK(GET_SIZE_H(block) == MIN_BLOCK + (size_t) idx * ALIGNMENT, "block %p of size %zu is in fast bin %d", (void*) block, GET_SIZE_H(block), idx);
     }
   }
-  //Case 4: prev and next are both free
-  else {
-    metadata_t* freelistIterator = freelist;
-    while(freelistIterator->next != NULL) {
-      if((freelistIterator < block) && (freelistIterator->next > block)) {
-        metadata_t* curNext = freelistIterator->next;
-        metadata_t* newNext = freelistIterator->next->next;
-        size_t newSize = GET_SIZE_H(block) + GET_SIZE_H((void*) blockF + FOOTER_T_ALIGNED) + GET_SIZE_F((void*) block - FOOTER_T_ALIGNED) + 2*METADATA_T_ALIGNED + 2*FOOTER_T_ALIGNED;
-        freelistIterator->size = PACK(newSize, 0);
-        footer_t* nextF = (footer_t*) ((void*) curNext + METADATA_T_ALIGNED + GET_SIZE_H(curNext));
-        nextF->size = freelistIterator->size;
-        freelistIterator->next = newNext;
-        newNext->prev = freelistIterator;
-        return;
-      }
-      freelistIterator = freelistIterator->next;
+  CHECK(parked == arena->fast_count, "fast_count is %u but %zu blocks are parked", arena->fast_count, parked);
+#endif
+
+  for(idx = 0; idx <= SLAB_CLASSES; idx++) {
+    slab_run_t* run = (idx < SLAB_CLASSES) ? arena->slab_partial[idx] : arena->slab_empty;
+    for(; run != NULL; run = run->next) {
+      unsigned int i, nfree = 0;
+      for(i = 0; i < SLAB_BITMAP_WORDS; i++)
+        nfree += __builtin_popcountll(run->bitmap[i]);
+      CHECK(run->arena == arena, "slab run %p belongs to another arena", (void*) run);
+      CHECK(run->nfree == nfree && nfree <= run->nslots, "slab run %p counts %u free slots but has %u", (void*) run, run->nfree, nfree);
+      if(idx < SLAB_CLASSES)
+        CHECK(run->slot_size == (idx + 1) * ALIGNMENT && nfree > 0, "slab run %p is on the wrong list", (void*) run);
+      else
+        CHECK(nfree == run->nslots, "slab run %p is on the empty list but in use", (void*) run);
     }
   }
+  return errors;
 }
 
-bool dmalloc_init() {
+bool dmm_check_heap() {
+  int a, errors = 0;
+  for(a = 0; a < NUM_ARENAS; a++) {
+    ARENA_LOCK(&arenas[a]);
+    errors += arena_check(&arenas[a]);
+    ARENA_UNLOCK(&arenas[a]);
+  }
+  return errors == 0;
+}
 
-  /* Two choices: 
-   * 1. Append prologue and epilogue blocks to the start and the
-   * end of the freelist 
-   *
-   * 2. Initialize freelist pointers to NULL
-   *
-   * Note: We provide the code for 2. Using 1 will help you to tackle the 
-   * corner cases succinctly.
-   */
+static void tree_stats(tree_node_t* node, dmm_stats_t* stats) {
+  if(node == NULL)
+    return;
+  size_t size = GET_SIZE_H(node);
+  stats->free_blocks++;
+  stats->free_bytes += size;
+  stats->free_hist[size_class(size)]++;
+  if(size > stats->largest_free)
+    stats->largest_free = size;
+  tree_stats(node->child[0], stats);
+  tree_stats(node->child[1], stats);
+}
+
+void dmm_get_stats(dmm_stats_t* stats) {
+  int a, idx;
+  size_t searches = 0, steps = 0;
+  memset(stats, 0, sizeof(*stats));
+  for(a = 0; a < NUM_ARENAS; a++) {
+    arena_t* arena = &arenas[a];
+    ARENA_LOCK(arena);
+    stats->heap_bytes += arena->os_bytes;
+    searches += arena->searches;
+    steps += arena->search_steps;
+    for(idx = 0; idx < NUM_SIZE_CLASSES; idx++) {
+      metadata_t* block;
+      stats->alloc_hist[idx] += arena->alloc_hist[idx];
+      for(block = arena->freelist[idx]; block != NULL; block = block->next) {
+        size_t size = GET_SIZE_H(block);
+        stats->free_blocks++;
+        stats->free_bytes += size;
+        stats->free_hist[idx]++;
+        if(size > stats->largest_free)
+          stats->largest_free = size;
+      }
+    }
+    tree_stats(arena->tree, stats);
+#ifdef DMM_FASTBINS
+    //Parked blocks are free as far as the program is concerned
+    for(idx = 0; idx < FASTBINS; idx++) {
+      metadata_t* block;
+      for(block = arena->fastbin[idx]; block != NULL; block = block->next) {
+        size_t size = GET_SIZE_H(block);
+        stats->free_blocks++;
+        stats->free_bytes += size;
+        stats->free_hist[size_class(size)]++;
+        if(size > stats->largest_free)
+          stats->largest_free = size;
+      }
+    }
+#endif
+    if(arena->wild != NULL) {
+      size_t size = GET_SIZE_H(arena->wild);
+      stats->free_blocks++;
+      stats->free_bytes += size;
+      stats->free_hist[size_class(size)]++;
+      if(size > stats->largest_free)
+        stats->largest_free = size;
+    }
+    ARENA_UNLOCK(arena);
+  }
+  stats->slab_bytes = slab_zone_used < SLAB_ZONE_SIZE ? slab_zone_used : SLAB_ZONE_SIZE;
+  stats->mmap_bytes = mmap_bytes;
+  stats->in_use = in_use_bytes;
+  stats->peak_in_use = peak_bytes;
+  stats->fragmentation = stats->free_bytes ? 1.0 - (double) stats->largest_free / stats->free_bytes : 0.0;
+  stats->avg_search = searches ? (double) steps / searches : 0.0;
+}
 
-  size_t max_bytes = ALIGN(MAX_HEAP_SIZE);
-
-  //Create prologue
-  metadata_t* prologue = (metadata_t*) sbrk(max_bytes); //Header
-  if(prologue == (void *)-1) //Not sure what this does...
-    return false; //...
-  prologue->prev = NULL;
-  prologue->size = PACK(0, 1);
-  footer_t* prologueF = (footer_t*) ((void*) prologue + METADATA_T_ALIGNED); //Footer
-  prologueF->size = prologue->size;
-
-  //Create freelist
-  metadata_t* firstBlock = (metadata_t*) ((void*) prologueF + FOOTER_T_ALIGNED); //Need to cast?
-  firstBlock->prev = prologue;
-  firstBlock->size = PACK(max_bytes - 3*METADATA_T_ALIGNED - 2*FOOTER_T_ALIGNED, 0);
-  footer_t* firstBlockF = (footer_t*) ((void*) firstBlock + METADATA_T_ALIGNED + GET_SIZE_H(firstBlock));
-  firstBlockF->size = firstBlock->size;
-  prologue->next = firstBlock;
+void dmm_print_stats() {
+  dmm_stats_t stats;
+  int idx;
+  dmm_get_stats(&stats);
+  printf("Heap: %zu bytes, slabs: %zu bytes, mapped: %zu bytes\n", stats.heap_bytes, stats.slab_bytes, stats.mmap_bytes);
+  printf("In use: %zu bytes, peak: %zu bytes\n", stats.in_use, stats.peak_in_use);
+  printf("Free blocks: %zu, free bytes: %zu, largest free block: %zu, fragmentation: %.3f\n",
+    stats.free_blocks, stats.free_bytes, stats.largest_free, stats.fragmentation);
+  printf("Average free-list search length: %.2f\n", stats.avg_search);
+  for(idx = 0; idx < NUM_SIZE_CLASSES; idx++) {
+    if(stats.alloc_hist[idx] != 0 || stats.free_hist[idx] != 0)
+      printf("\tClass %d (%zu+ bytes): %zu allocations, %zu free blocks\n",
+        idx, ((size_t) ALIGNMENT) << idx, stats.alloc_hist[idx], stats.free_hist[idx]);
+  }
+}
 
-  //Create epilogue
-  metadata_t* epilogue = (metadata_t*) ((void*) prologue + max_bytes - METADATA_T_ALIGNED); //Header
-  epilogue->next = NULL;
-  epilogue->prev = firstBlock;
-  epilogue->size = PACK(0, 1);
-  firstBlock->next = epilogue;
+#ifdef DMM_PROFILE
+void dmm_profile_dump() {
+  int i;
+  PROFILE_LOCK();
+  printf("Sampled allocation sites (one sample per %d bytes):\n", PROFILE_SAMPLE_BYTES);
+  for(i = 0; i < PROFILE_SITES; i++) {
+    if(profile_sites[i].site != NULL)
+      printf("\t%p: %zu samples, %zu sampled bytes, ~%zu bytes allocated\n",
+        profile_sites[i].site,
+        profile_sites[i].samples,
+        profile_sites[i].bytes,
+        profile_sites[i].samples * (size_t) PROFILE_SAMPLE_BYTES);
+  }
+  PROFILE_UNLOCK();
+}
+#else
+void dmm_profile_dump() {
+  printf("Heap profiling is disabled; rebuild with -DDMM_PROFILE\n");
+}
+#endif
 
-  freelist = prologue;
-  return true;
+static void tree_print(int a, tree_node_t* node) {
+  if(node == NULL)
+    return;
+  tree_print(a, node->child[0]);
+  DEBUG("\tArena:%d, Tree, Freelist Size:%zd, Node:%p, Left:%p, Right:%p\t",
+  a,
+  node->size,
+  node,
+  node->child[0],
+  node->child[1]);
+  tree_print(a, node->child[1]);
 }
 
 /* for debugging; can be turned off through -NDEBUG flag*/
 void print_freelist() {
-  metadata_t *freelist_head = freelist;
-  while(freelist_head != NULL) {
-    DEBUG("\tFreelist Size:%zd, Head:%p, Prev:%p, Next:%p\t",
-    freelist_head->size,
-    freelist_head,
-    freelist_head->prev,
-    freelist_head->next);
-    freelist_head = freelist_head->next;
+  int a, idx;
+  for(a = 0; a < NUM_ARENAS; a++) {
+    for(idx = 0; idx < NUM_SIZE_CLASSES; idx++) {
+      metadata_t *freelist_head = arenas[a].freelist[idx];
+      while(freelist_head != NULL) {
+        DEBUG("\tArena:%d, Class:%d, Freelist Size:%zd, Head:%p, Prev:%p, Next:%p\t",
+        a,
+        idx,
+        freelist_head->size,
+        freelist_head,
+        freelist_head->prev,
+        freelist_head->next);
+        freelist_head = freelist_head->next;
+      }
+    }
+    tree_print(a, arenas[a].tree);
+    if(arenas[a].wild != NULL)
+      DEBUG("\tArena:%d, Wild, Freelist Size:%zd, Block:%p\t",
+      a,
+      arenas[a].wild->size,
+      arenas[a].wild);
+#ifdef DMM_FASTBINS
+    for(idx = 0; idx < FASTBINS; idx++) {
+      metadata_t* block;
+      for(block = arenas[a].fastbin[idx]; block != NULL; block = block->next)
+        DEBUG("\tArena:%d, Fast bin:%d, Freelist Size:%zd, Block:%p, Next:%p\t",
+        a,
+        idx,
+        block->size,
+        block,
+        block->next);
+    }
+#endif
+    for(idx = 0; idx < SLAB_CLASSES; idx++) {
+      struct slab_run* run;
+      for(run = arenas[a].slab_partial[idx]; run != NULL; run = run->next)
+        DEBUG("\tArena:%d, Slab slot size:%u, Free slots:%u/%u, Run:%p\t",
+        a,
+        run->slot_size,
+        run->nfree,
+        run->nslots,
+        run);
+    }
   }
   DEBUG("\n");
 }
@@ -1,12 +1,74 @@
 #ifndef __CPS210_MM_H__ 	/* check if this header file is already defined elsewhere */
 #define __CPS210_MM_H__
 
+#include <stdint.h>
 
-/* You do not need to change MAX_HEAP_SIZE 
+
+/* The heap is no longer capped: it starts at INITIAL_HEAP_SIZE and grows in
+ * HEAP_CHUNK_SIZE steps for as long as the OS hands out memory. A free block
+ * at the top of the heap larger than TRIM_THRESHOLD is returned to the OS.
+ * MAX_HEAP_SIZE is kept as the scale the tests size their requests from.
+ */
+//#define MAX_HEAP_SIZE	(1024*1024*32) /* 32 MB */
+#define MAX_HEAP_SIZE	(1024*1024*4) /* 4MB, recommended setting for test_stress2 */
+//#define MAX_HEAP_SIZE	(1024) /* 1kB*/
+
+#define INITIAL_HEAP_SIZE	(1024*64)
+#define HEAP_CHUNK_SIZE		(1024*64)
+#define TRIM_THRESHOLD		(1024*256)
+
+/* Requests of at least MMAP_THRESHOLD bytes get their own mapping instead of
+ * coming from the heap, and are unmapped as soon as they are freed.
+ */
+#define MMAP_THRESHOLD		(1024*128)
+
+/* Largest request the public entry points accept. Anything bigger fails with
+ * ENOMEM before aligning it or adding a header to it could wrap around.
+ */
+#define MAX_REQUEST_SIZE	((size_t) PTRDIFF_MAX)
+
+/* Per-thread caches used when built with -DDMM_THREAD_SAFE: payloads up to
+ * TCACHE_MAX_SIZE bytes are cached per thread, at most TCACHE_BIN_MAX blocks
+ * per size, moving TCACHE_BATCH blocks at a time to and from the shared heap.
+ */
+#define TCACHE_MAX_SIZE		512
+#define TCACHE_BIN_MAX		64
+#define TCACHE_BATCH		16
+
+/* Payloads of up to SLAB_MAX_SIZE bytes are packed into SLAB_RUN_SIZE runs of
+ * equal slots taken from a SLAB_ZONE_SIZE virtual reservation.
  */
-//#define MAX_HEAP_SIZE	(1024*1024*32) /* max size restricted to 32 MB */
-#define MAX_HEAP_SIZE	(1024*1024*4) /* max size restricted to 4MB, recommended setting for test_stress2 */
-//#define MAX_HEAP_SIZE	(1024) /* max size restricted to 1kB*/
+#define SLAB_MAX_SIZE		64
+#define SLAB_RUN_SIZE		4096
+#define SLAB_ZONE_SIZE		(1024UL*1024*1024)
+
+/* Hardened builds (-DDMM_HARDENED) hold the last QUARANTINE_BLOCKS freed heap
+ * blocks of each arena back from reuse, poisoning their first
+ * QUARANTINE_POISON bytes, and check a whole arena every HARDEN_CHECK_INTERVAL
+ * frees.
+ */
+#define QUARANTINE_BLOCKS	256
+#define QUARANTINE_POISON	64
+#define HARDEN_CHECK_INTERVAL	(1 << 16)
+
+/* Builds with -DDMM_FASTBINS park freed heap blocks with payloads of up to
+ * FASTBIN_MAX_SIZE bytes in per-size quick lists without coalescing them, and
+ * consolidate an arena's parked blocks once FASTBIN_LIMIT of them pile up or
+ * an allocation finds no fit short of the top of the heap.
+ */
+#define FASTBIN_MAX_SIZE	512
+#define FASTBIN_LIMIT		256
+
+/* Regions (dmm_region_create) bump-allocate from chunks of
+ * DMM_REGION_CHUNK_SIZE bytes unless told otherwise; requests larger than a
+ * quarter of the chunk size get a chunk of their own.
+ */
+#define DMM_REGION_CHUNK_SIZE	(1024*16)
+
+/* Number of independent arenas threads are spread over in the thread-safe
+ * build (at most 256); single-threaded builds only use the first.
+ */
+#define NUM_ARENAS		8
 
 /* On 32-bit machines, change this to 4 */
 #define WORD_SIZE	8
@@ -22,6 +84,17 @@
 
 #define METADATA_T_ALIGNED (ALIGN(sizeof(metadata_t)))
 
+/* Free blocks of at least TREE_MIN_SIZE bytes, header included, are indexed
+ * by a size-ordered tree instead of the segregated lists. Keep it a power of
+ * two of at least 64 so it starts a size class.
+ */
+#define TREE_MIN_SIZE		1024
+
+/* Number of segregated free lists; class i holds payloads in [8 << i, 16 << i)
+ * and the last class holds everything larger.
+ */
+#define NUM_SIZE_CLASSES 24
+
 #ifdef NDEBUG
 	#define DEBUG(M, ...)
 	#define PRINT_FREELIST print_freelist
@@ -32,10 +105,103 @@
 
 typedef enum{false, true} bool;
 
+/* Sampling interval and number of distinct call sites tracked by the heap
+ * profiler built with -DDMM_PROFILE.
+ */
+#define PROFILE_SAMPLE_BYTES	(1024*512)
+#define PROFILE_SITES		1024
+
+/* Recording mode built with -DDMM_TRACE: calls are buffered in a ring of
+ * TRACE_RING_RECORDS records that a background thread writes out every
+ * TRACE_FLUSH_MS milliseconds to $DMM_TRACE_FILE (default "dmm.trace").
+ * The file is a dmm_trace_header_t followed by dmm_trace_rec_t records;
+ * mdriver replays it directly. A free is ordered by when it started to give
+ * its block back and an allocation by when it got its block, so an address
+ * is never allocated again before the record that released it.
+ */
+#define TRACE_RING_RECORDS	(1 << 16)
+#define TRACE_FLUSH_MS		10
+
+#define DMM_TRACE_MAGIC		"DMMTRACE"
+#define DMM_TRACE_VERSION	1
+
+#define DMM_TRACE_ALLOC		'a'	/* ptr = dmalloc(size), also dcalloc/daligned_alloc */
+#define DMM_TRACE_FREE		'f'	/* dfree(ptr) */
+#define DMM_TRACE_REALLOC	'r'	/* ptr = drealloc(old_ptr, size) */
+
+typedef struct dmm_trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t rec_size;
+} dmm_trace_header_t;
+
+typedef struct dmm_trace_rec {
+	uint64_t time_ns;	/* since the first recorded call */
+	uint64_t ptr;
+	uint64_t old_ptr;
+	uint32_t size;		/* requested bytes, saturated at 4 GB */
+	uint16_t thread;	/* small per-thread number, in order of first call */
+	uint8_t op;
+	uint8_t pad;
+} dmm_trace_rec_t;
+
+/* Snapshot filled in by dmm_get_stats. Sizes are in bytes; free-block figures
+ * cover the arena free lists, and the histograms are indexed by the same
+ * power-of-two size classes.
+ */
+typedef struct dmm_stats {
+	size_t heap_bytes;	/* obtained from the OS for the arenas */
+	size_t slab_bytes;	/* handed out as slab runs */
+	size_t mmap_bytes;	/* in direct mappings for large blocks */
+	size_t in_use;		/* usable bytes currently allocated */
+	size_t peak_in_use;	/* high-water mark of in_use */
+	size_t free_blocks;
+	size_t free_bytes;
+	size_t largest_free;
+	double fragmentation;	/* 1 - largest_free / free_bytes */
+	double avg_search;	/* free blocks examined per heap allocation */
+	size_t alloc_hist[NUM_SIZE_CLASSES];	/* blocks allocated per class */
+	size_t free_hist[NUM_SIZE_CLASSES];	/* free blocks per class */
+} dmm_stats_t;
+
 bool dmalloc_init();
 void *dmalloc(size_t numbytes);
 void dfree(void *allocptr);
+void *drealloc(void *allocptr, size_t numbytes);
+void *dcalloc(size_t nmemb, size_t numbytes);
+void *daligned_alloc(size_t alignment, size_t numbytes);
+int dposix_memalign(void **memptr, size_t alignment, size_t numbytes);
+size_t dmalloc_usable_size(void *allocptr);
+
+/* pthread_atfork handlers keeping the arena locks consistent across fork;
+ * no-ops unless built with -DDMM_THREAD_SAFE.
+ */
+void dmm_fork_prepare();
+void dmm_fork_parent();
+void dmm_fork_child();
+
+bool dmm_check_heap(); /* walks every arena, reporting problems on stderr */
+void dmm_get_stats(dmm_stats_t *stats); /* always available, locks each arena briefly */
+void dmm_print_stats();
+void dmm_profile_dump(); /* call sites sampled under -DDMM_PROFILE */
+
+
+/* Regions serve many short-lived objects that all die together, such as
+ * everything built while handling one request. Objects come from chunks that
+ * are themselves taken from dmalloc and cannot be freed one by one; instead
+ * dmm_region_reset releases everything at once, in time proportional to the
+ * number of chunks. dmm_region_begin and dmm_region_end bracket a nested
+ * scope whose objects are released by the matching end. A region is not
+ * thread-safe: give each thread its own.
+ */
+typedef struct dmm_region dmm_region_t;
 
+dmm_region_t *dmm_region_create(size_t chunk_size); /* 0 for DMM_REGION_CHUNK_SIZE */
+void *dmm_region_alloc(dmm_region_t *region, size_t numbytes);
+bool dmm_region_begin(dmm_region_t *region);
+void dmm_region_end(dmm_region_t *region);
+void dmm_region_reset(dmm_region_t *region);
+void dmm_region_destroy(dmm_region_t *region);
 
 void print_freelist(); /* optional for debugging */
 
@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "dmm.h"
+
+/* Exports the standard allocation entry points on top of dmm so that any
+ * dynamically linked program can run on it:
+ *
+ *	LD_PRELOAD=./libdmm.so ./program
+ *
+ * The C library and the dynamic loader may call malloc before our constructor
+ * runs, or from inside dmm itself (pthread_setspecific and pthread_atfork both
+ * allocate on some paths). A thread that re-enters the allocator is served from
+ * a small static bootstrap buffer instead; those blocks are never reused and
+ * free simply ignores them.
+ */
+
+#define BOOTSTRAP_SIZE (64*1024)
+#define BOOTSTRAP_ALIGN 16
+
+static char bootstrap_heap[BOOTSTRAP_SIZE] __attribute__((aligned(BOOTSTRAP_ALIGN)));
+static size_t bootstrap_used = 0;
+static __thread int in_dmm = 0;
+
+#define IS_BOOTSTRAP(p) ((char*) (p) >= bootstrap_heap && (char*) (p) < bootstrap_heap + BOOTSTRAP_SIZE)
+
+/* Each bootstrap block is preceded by its size so realloc can copy it out. */
+static void* bootstrap_alloc(size_t alignment, size_t size) {
+  if(alignment < BOOTSTRAP_ALIGN)
+    alignment = BOOTSTRAP_ALIGN;
+  if(size > BOOTSTRAP_SIZE || alignment > BOOTSTRAP_SIZE) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  size_t need = alignment + ((size + BOOTSTRAP_ALIGN - 1) & ~(size_t) (BOOTSTRAP_ALIGN - 1));
+  //Only claim the space once it is known to fit, so a failed request uses none of it
+  size_t start = __atomic_load_n(&bootstrap_used, __ATOMIC_RELAXED);
+  do {
+    if(start + need > BOOTSTRAP_SIZE) {
+      errno = ENOMEM;
+      return NULL;
+    }
+  } while(!__atomic_compare_exchange_n(&bootstrap_used, &start, start + need, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  char* ptr = bootstrap_heap + start + alignment;
+  ptr -= (uintptr_t) ptr & (alignment - 1);
+  ((size_t*) ptr)[-1] = size;
+  return ptr;
+}
+
+static size_t bootstrap_size(void* ptr) {
+  return ((size_t*) ptr)[-1];
+}
+
+static void* checked(void* ptr) {
+  if(ptr == NULL)
+    errno = ENOMEM;
+  return ptr;
+}
+
+void* malloc(size_t size) {
+  if(in_dmm)
+    return bootstrap_alloc(0, size);
+  in_dmm = 1;
+  void* ptr = dmalloc(size ? size : 1);
+  in_dmm = 0;
+  return checked(ptr);
+}
+
+void free(void* ptr) {
+  if(ptr == NULL || IS_BOOTSTRAP(ptr))
+    return;
+  int saved = errno;
+  in_dmm = 1;
+  dfree(ptr);
+  in_dmm = 0;
+  errno = saved;
+}
+
+void* calloc(size_t nmemb, size_t size) {
+  if(size != 0 && nmemb > (size_t) -1 / size) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  if(in_dmm)
+    return bootstrap_alloc(0, nmemb * size); //The static buffer starts out zeroed and is never reused
+  if(nmemb == 0 || size == 0)
+    nmemb = size = 1;
+  in_dmm = 1;
+  void* ptr = dcalloc(nmemb, size);
+  in_dmm = 0;
+  return checked(ptr);
+}
+
+void* realloc(void* ptr, size_t size) {
+  if(ptr != NULL && IS_BOOTSTRAP(ptr)) {
+    void* copy = malloc(size);
+    if(copy != NULL)
+      memcpy(copy, ptr, bootstrap_size(ptr) < size ? bootstrap_size(ptr) : size);
+    return copy;
+  }
+  if(in_dmm) {
+    //Move a dmm block out to the bootstrap heap rather than resize it from inside dmm
+    void* copy = bootstrap_alloc(0, size);
+    if(copy != NULL && ptr != NULL) {
+      size_t old = dmalloc_usable_size(ptr);
+      memcpy(copy, ptr, old < size ? old : size);
+      dfree(ptr);
+    }
+    return copy;
+  }
+  if(ptr == NULL)
+    return malloc(size);
+  in_dmm = 1;
+  void* newPtr = drealloc(ptr, size);
+  in_dmm = 0;
+  //drealloc frees the block on a zero size, the other case that returns NULL
+  return size == 0 ? NULL : checked(newPtr);
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size) {
+  if(in_dmm) {
+    if(alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+      return EINVAL;
+    *memptr = bootstrap_alloc(alignment, size);
+    return *memptr == NULL ? ENOMEM : 0;
+  }
+  in_dmm = 1;
+  int err = dposix_memalign(memptr, alignment, size ? size : 1);
+  in_dmm = 0;
+  return err;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  if(alignment == 0 || (alignment & (alignment - 1)) != 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  if(in_dmm)
+    return bootstrap_alloc(alignment, size);
+  in_dmm = 1;
+  void* ptr = daligned_alloc(alignment, size ? size : 1);
+  in_dmm = 0;
+  return checked(ptr);
+}
+
+void* memalign(size_t alignment, size_t size) {
+  return aligned_alloc(alignment, size);
+}
+
+void* valloc(size_t size) {
+  return aligned_alloc(sysconf(_SC_PAGESIZE), size);
+}
+
+void* pvalloc(size_t size) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  if(size > (size_t) -1 - page) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  return aligned_alloc(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void* ptr) {
+  if(ptr != NULL && IS_BOOTSTRAP(ptr))
+    return bootstrap_size(ptr);
+  return dmalloc_usable_size(ptr);
+}
+
+__attribute__((constructor))
+static void dmm_preload_init() {
+  in_dmm = 1;
+  pthread_atfork(dmm_fork_prepare, dmm_fork_parent, dmm_fork_child);
+  dmalloc_init();
+  in_dmm = 0;
+}
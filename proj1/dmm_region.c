@@ -0,0 +1,146 @@
+#include <stddef.h>
+
+#include "dmm.h"
+
+/* Regions on top of dmalloc. A region owns two stacks of chunks, newest
+ * first: bump chunks of chunk_size bytes, of which only the newest has room
+ * left, in [ptr, end), and dedicated chunks holding one large object each.
+ * Allocating moves ptr forward or pushes a chunk; nothing else is tracked
+ * per object, so releasing is just a walk over the chunks.
+ *
+ * A scope is a snapshot of both stack heads and of [ptr, end), stored in the
+ * region itself right after the point it records, so scopes nest without
+ * any other memory. Ending a scope frees every chunk pushed since and rewinds
+ * ptr, which also drops the snapshot. One released bump chunk is kept as a
+ * spare so a region used once per request does not go back to dmalloc for
+ * its first chunk every time.
+ */
+
+#define REGION_MIN_CHUNK (256)
+
+typedef struct region_chunk {
+  struct region_chunk* next;
+} region_chunk_t;
+
+#define CHUNK_T_ALIGNED (ALIGN(sizeof(region_chunk_t)))
+
+typedef struct region_scope {
+  struct region_scope* outer;
+  region_chunk_t* chunks;
+  region_chunk_t* large;
+  char* ptr;
+  char* end;
+} region_scope_t;
+
+struct dmm_region {
+  region_chunk_t* chunks;
+  region_chunk_t* large;
+  region_chunk_t* spare;
+  char* ptr;
+  char* end;
+  size_t chunk_size;
+  region_scope_t* scope;
+};
+
+dmm_region_t* dmm_region_create(size_t chunk_size) {
+  dmm_region_t* region = dmalloc(sizeof(dmm_region_t));
+  if(region == NULL)
+    return NULL;
+  if(chunk_size == 0)
+    chunk_size = DMM_REGION_CHUNK_SIZE;
+  region->chunk_size = chunk_size < REGION_MIN_CHUNK ? REGION_MIN_CHUNK : ALIGN(chunk_size);
+  region->chunks = region->large = region->spare = NULL;
+  region->ptr = region->end = NULL;
+  region->scope = NULL;
+  return region;
+}
+
+/* Gives a dedicated chunk to a request too big to share one */
+static void* region_alloc_large(dmm_region_t* region, size_t size) {
+  if(size > (size_t) -1 - CHUNK_T_ALIGNED)
+    return NULL;
+  region_chunk_t* chunk = dmalloc(CHUNK_T_ALIGNED + size);
+  if(chunk == NULL)
+    return NULL;
+  chunk->next = region->large;
+  region->large = chunk;
+  return (char*) chunk + CHUNK_T_ALIGNED;
+}
+
+void* dmm_region_alloc(dmm_region_t* region, size_t numbytes) {
+  if(numbytes > (size_t) -1 - ALIGNMENT)
+    return NULL;
+  size_t size = ALIGN(numbytes ? numbytes : 1);
+  if(size > region->chunk_size / 4)
+    return region_alloc_large(region, size);
+  if((size_t) (region->end - region->ptr) < size) {
+    //Start a new bump chunk; what is left of the old one is wasted
+    region_chunk_t* chunk = region->spare;
+    if(chunk != NULL)
+      region->spare = NULL;
+    else if((chunk = dmalloc(region->chunk_size)) == NULL)
+      return NULL;
+    chunk->next = region->chunks;
+    region->chunks = chunk;
+    region->ptr = (char*) chunk + CHUNK_T_ALIGNED;
+    region->end = (char*) chunk + region->chunk_size;
+  }
+  void* ptr = region->ptr;
+  region->ptr += size;
+  return ptr;
+}
+
+/* Frees chunks off the top of both stacks until they are back to the given
+ * heads, keeping one bump chunk as the spare.
+ */
+static void region_release(dmm_region_t* region, region_chunk_t* chunks, region_chunk_t* large) {
+  while(region->large != large) {
+    region_chunk_t* chunk = region->large;
+    region->large = chunk->next;
+    dfree(chunk);
+  }
+  while(region->chunks != chunks) {
+    region_chunk_t* chunk = region->chunks;
+    region->chunks = chunk->next;
+    if(region->spare == NULL)
+      region->spare = chunk;
+    else
+      dfree(chunk);
+  }
+}
+
+bool dmm_region_begin(dmm_region_t* region) {
+  region_scope_t saved = { region->scope, region->chunks, region->large, region->ptr, region->end };
+  region_scope_t* scope = dmm_region_alloc(region, sizeof(region_scope_t));
+  if(scope == NULL)
+    return false;
+  *scope = saved;
+  region->scope = scope;
+  return true;
+}
+
+void dmm_region_end(dmm_region_t* region) {
+  if(region->scope == NULL)
+    return;
+  //The snapshot lives in memory the release gives back, so copy it out first
+  region_scope_t saved = *region->scope;
+  region_release(region, saved.chunks, saved.large);
+  region->ptr = saved.ptr;
+  region->end = saved.end;
+  region->scope = saved.outer;
+}
+
+void dmm_region_reset(dmm_region_t* region) {
+  region_release(region, NULL, NULL);
+  region->ptr = region->end = NULL;
+  region->scope = NULL;
+}
+
+void dmm_region_destroy(dmm_region_t* region) {
+  if(region == NULL)
+    return;
+  dmm_region_reset(region);
+  if(region->spare != NULL)
+    dfree(region->spare);
+  dfree(region);
+}
@@ -0,0 +1,536 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <dirent.h>
+#include <malloc.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include "dmm.h"
+
+/* Trace-driven benchmark in the style of the CS:APP malloc driver. A trace
+ * file starts with four header lines (suggested heap size, number of ids,
+ * number of operations, weight), followed by one operation per line:
+ *
+ *	a <id> <bytes>	allocate a block and name it <id>
+ *	r <id> <bytes>	reallocate block <id>
+ *	f <id>		free block <id>
+ *
+ * Binary traces written by a -DDMM_TRACE build of dmm are accepted as well;
+ * their pointers are mapped to ids as they are loaded, and calls from all
+ * recorded threads are replayed on one thread in the order they completed.
+ *
+ * Every (trace, allocator) pair runs in a forked child so each starts from a
+ * fresh heap. The child first replays the trace once untimed, checking block
+ * contents and alignment and sampling memory use, then times REPEAT replays.
+ *
+ * Utilization is the peak of live payload bytes divided by the peak memory
+ * the allocator held from the OS, sampled over the replay. The driver keeps
+ * its own tables in private mappings so that they do not count against, or
+ * pre-grow, the system allocator. Fragmentation is sampled from dmm_get_stats
+ * (1 - largest free block / free bytes); the system allocator does not expose
+ * it.
+ */
+
+#define DEFAULT_TRACEDIR "traces"
+#define REPEAT (10)
+#define SAMPLES (100)	/* fragmentation samples per trace */
+#define MAX_TRACES (64)
+
+typedef struct op {
+	char type;
+	int id;
+	size_t size;
+} op_t;
+
+typedef struct trace {
+	char name[256];
+	int num_ids;
+	int num_ops;
+	op_t *ops;
+	size_t ops_bytes;	/* size of the ops mapping, which can hold more than num_ops */
+} trace_t;
+
+typedef struct allocator {
+	const char *name;
+	void *(*malloc)(size_t);
+	void (*free)(void *);
+	void *(*realloc)(void *, size_t);
+	size_t (*footprint)(double *frag);
+} allocator_t;
+
+typedef struct result {
+	int ok;
+	double secs;
+	double util;
+	double frag_avg;
+	double frag_max;
+} result_t;
+
+static int verbose = 0;
+
+static void *table_alloc(size_t size) {
+	void *ptr = mmap(NULL, size ? size : 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+static void table_free(void *ptr, size_t size) {
+	munmap(ptr, size ? size : 1);
+}
+
+static size_t dmm_footprint(double *frag) {
+	dmm_stats_t stats;
+	dmm_get_stats(&stats);
+	*frag = stats.fragmentation;
+	return stats.heap_bytes + stats.slab_bytes + stats.mmap_bytes;
+}
+
+static size_t libc_footprint(double *frag) {
+	struct mallinfo2 info = mallinfo2();
+	*frag = -1.0;
+	return info.arena + info.hblkhd;
+}
+
+static void *libc_malloc(size_t size) { return malloc(size); }
+static void libc_free(void *ptr) { free(ptr); }
+static void *libc_realloc(void *ptr, size_t size) { return realloc(ptr, size); }
+
+static allocator_t allocators[] = {
+	{ "dmm", dmalloc, dfree, drealloc, dmm_footprint },
+	{ "libc", libc_malloc, libc_free, libc_realloc, libc_footprint },
+};
+#define NUM_ALLOCATORS ((int) (sizeof(allocators) / sizeof(allocators[0])))
+
+/* Maps recorded block addresses to trace ids with open addressing. A freed
+ * address keeps its slot with id -1 so later probes still pass over it.
+ */
+typedef struct addr_map {
+	uint64_t *keys;
+	int *ids;
+	size_t mask;
+} addr_map_t;
+
+static int *addr_slot(addr_map_t *map, uint64_t addr) {
+	size_t i = (addr >> 4) * 0x9e3779b97f4a7c15ULL & map->mask;
+	while(map->keys[i] != 0 && map->keys[i] != addr)
+		i = (i + 1) & map->mask;
+	if(map->keys[i] == 0) {
+		map->keys[i] = addr;
+		map->ids[i] = -1;
+	}
+	return &map->ids[i];
+}
+
+static int read_binary_trace(FILE *fp, const char *path, trace_t *trace) {
+	dmm_trace_header_t header;
+	dmm_trace_rec_t rec;
+	addr_map_t map;
+	size_t records, capacity = 1;
+	long start;
+	int *slot, id;
+
+	if(fread(&header, sizeof(header), 1, fp) != 1 || header.version != DMM_TRACE_VERSION
+			|| header.rec_size != sizeof(dmm_trace_rec_t)) {
+		fprintf(stderr, "%s: unsupported binary trace\n", path);
+		return 0;
+	}
+	start = ftell(fp);
+	fseek(fp, 0, SEEK_END);
+	records = (ftell(fp) - start) / sizeof(rec);
+	fseek(fp, start, SEEK_SET);
+
+	while(capacity < 2 * records + 2)
+		capacity <<= 1;
+	map.keys = table_alloc(capacity * sizeof(uint64_t));
+	map.ids = table_alloc(capacity * sizeof(int));
+	map.mask = capacity - 1;
+	trace->ops_bytes = records * sizeof(op_t);
+	trace->ops = table_alloc(trace->ops_bytes);
+	trace->num_ops = 0;
+	trace->num_ids = 0;
+	while(fread(&rec, sizeof(rec), 1, fp) == 1) {
+		op_t *op = &trace->ops[trace->num_ops];
+		if(rec.op == DMM_TRACE_REALLOC && rec.old_ptr != 0) {
+			slot = addr_slot(&map, rec.old_ptr);
+			id = *slot;
+			if(id < 0)
+				continue; //Block from before recording started, or its allocation was dropped
+			*slot = -1;
+			if(rec.size == 0) {
+				op->type = 'f';
+			} else {
+				if(rec.ptr == 0) {
+					*slot = id; //Failed realloc leaves the old block alone
+					continue;
+				}
+				*addr_slot(&map, rec.ptr) = id;
+				op->type = 'r';
+			}
+		} else if(rec.op == DMM_TRACE_ALLOC || rec.op == DMM_TRACE_REALLOC) {
+			if(rec.ptr == 0 || rec.size == 0)
+				continue;
+			id = trace->num_ids++;
+			*addr_slot(&map, rec.ptr) = id;
+			op->type = 'a';
+		} else if(rec.op == DMM_TRACE_FREE) {
+			slot = addr_slot(&map, rec.ptr);
+			id = *slot;
+			if(id < 0)
+				continue;
+			*slot = -1;
+			op->type = 'f';
+		} else {
+			continue;
+		}
+		op->id = id;
+		op->size = rec.size;
+		trace->num_ops++;
+	}
+	table_free(map.keys, capacity * sizeof(uint64_t));
+	table_free(map.ids, capacity * sizeof(int));
+	return 1;
+}
+
+static int read_trace(const char *path, trace_t *trace) {
+	FILE *fp = fopen(path, "r");
+	int heap_size, weight, i;
+	const char *base = strrchr(path, '/');
+
+	if(fp == NULL) {
+		perror(path);
+		return 0;
+	}
+	snprintf(trace->name, sizeof(trace->name), "%s", base ? base + 1 : path);
+	char magic[sizeof(DMM_TRACE_MAGIC) - 1];
+	if(fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, DMM_TRACE_MAGIC, sizeof(magic)) == 0) {
+		rewind(fp);
+		int ok = read_binary_trace(fp, path, trace);
+		fclose(fp);
+		return ok;
+	}
+	rewind(fp);
+	if(fscanf(fp, "%d %d %d %d", &heap_size, &trace->num_ids, &trace->num_ops, &weight) != 4) {
+		fprintf(stderr, "%s: bad trace header\n", path);
+		fclose(fp);
+		return 0;
+	}
+	if(trace->num_ops < 0 || trace->num_ids <= 0) {
+		fprintf(stderr, "%s: bad trace header\n", path);
+		fclose(fp);
+		return 0;
+	}
+	trace->ops_bytes = (size_t) trace->num_ops * sizeof(op_t);
+	trace->ops = table_alloc(trace->ops_bytes);
+	if(trace->ops == NULL) {
+		fprintf(stderr, "%s: trace too large\n", path);
+		fclose(fp);
+		return 0;
+	}
+	for(i = 0; i < trace->num_ops; i++) {
+		op_t *op = &trace->ops[i];
+		char type[2];
+		if(fscanf(fp, "%1s", type) != 1)
+			break;
+		op->type = type[0];
+		op->size = 0;
+		if(op->type == 'f') {
+			if(fscanf(fp, "%d", &op->id) != 1)
+				break;
+		} else if(op->type == 'a' || op->type == 'r') {
+			if(fscanf(fp, "%d %zu", &op->id, &op->size) != 2)
+				break;
+		} else {
+			break;
+		}
+		if(op->id < 0 || op->id >= trace->num_ids)
+			break;
+	}
+	fclose(fp);
+	if(i != trace->num_ops) {
+		fprintf(stderr, "%s: bad operation %d\n", path, i);
+		table_free(trace->ops, trace->ops_bytes);
+		return 0;
+	}
+	return 1;
+}
+
+/* Blocks are filled with a byte derived from their id so that a block handed
+ * out twice, or clobbered by the allocator's own metadata, shows up on free.
+ */
+static int check_block(const trace_t *trace, int id, unsigned char *ptr, size_t size) {
+	size_t i;
+	for(i = 0; i < size; i++) {
+		if(ptr[i] != (unsigned char) id) {
+			fprintf(stderr, "%s: block %d corrupted at byte %zu\n", trace->name, id, i);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int replay_checked(const allocator_t *alloc, const trace_t *trace, result_t *res) {
+	void **ptrs = table_alloc(trace->num_ids * sizeof(void *));
+	size_t *sizes = table_alloc(trace->num_ids * sizeof(size_t));
+	size_t live = 0, peak_live = 0, peak_footprint = 0, footprint;
+	int interval = trace->num_ops / SAMPLES > 0 ? trace->num_ops / SAMPLES : 1;
+	int i, samples = 0;
+	double frag, frag_sum = 0.0;
+
+	res->frag_max = 0.0;
+	for(i = 0; i < trace->num_ops; i++) {
+		const op_t *op = &trace->ops[i];
+		void *ptr;
+		switch(op->type) {
+		case 'a':
+			if(op->size == 0)
+				break;
+			ptr = alloc->malloc(op->size);
+			if(ptr == NULL || ((uintptr_t) ptr & (ALIGNMENT - 1)) != 0) {
+				fprintf(stderr, "%s: allocation %d failed or misaligned\n", trace->name, i);
+				return 0;
+			}
+			memset(ptr, op->id, op->size);
+			ptrs[op->id] = ptr;
+			sizes[op->id] = op->size;
+			live += op->size;
+			break;
+		case 'r':
+			if(op->size == 0)
+				break;
+			if(ptrs[op->id] != NULL && !check_block(trace, op->id, ptrs[op->id], sizes[op->id]))
+				return 0;
+			ptr = alloc->realloc(ptrs[op->id], op->size);
+			if(ptr == NULL || ((uintptr_t) ptr & (ALIGNMENT - 1)) != 0) {
+				fprintf(stderr, "%s: reallocation %d failed or misaligned\n", trace->name, i);
+				return 0;
+			}
+			if(!check_block(trace, op->id, ptr, sizes[op->id] < op->size ? sizes[op->id] : op->size))
+				return 0;
+			memset(ptr, op->id, op->size);
+			live += op->size - sizes[op->id];
+			ptrs[op->id] = ptr;
+			sizes[op->id] = op->size;
+			break;
+		case 'f':
+			if(ptrs[op->id] == NULL)
+				break;
+			if(!check_block(trace, op->id, ptrs[op->id], sizes[op->id]))
+				return 0;
+			alloc->free(ptrs[op->id]);
+			live -= sizes[op->id];
+			ptrs[op->id] = NULL;
+			sizes[op->id] = 0;
+			break;
+		}
+		if(live > peak_live)
+			peak_live = live;
+		if(i % interval == 0 || i == trace->num_ops - 1) {
+			footprint = alloc->footprint(&frag);
+			if(footprint > peak_footprint)
+				peak_footprint = footprint;
+			if(frag >= 0.0) {
+				frag_sum += frag;
+				samples++;
+				if(frag > res->frag_max)
+					res->frag_max = frag;
+				if(verbose)
+					printf("  %s %s op=%d live=%zu footprint=%zu frag=%.3f\n", trace->name, alloc->name, i, live, footprint, frag);
+			}
+		}
+	}
+	for(i = 0; i < trace->num_ids; i++) {
+		if(ptrs[i] != NULL)
+			alloc->free(ptrs[i]);
+	}
+	res->util = peak_footprint ? (double) peak_live / peak_footprint : 0.0;
+	res->frag_avg = samples ? frag_sum / samples : -1.0;
+	if(samples == 0)
+		res->frag_max = -1.0;
+	table_free(ptrs, trace->num_ids * sizeof(void *));
+	table_free(sizes, trace->num_ids * sizeof(size_t));
+	return 1;
+}
+
+static void replay(const allocator_t *alloc, const trace_t *trace, void **ptrs) {
+	int i;
+	for(i = 0; i < trace->num_ops; i++) {
+		const op_t *op = &trace->ops[i];
+		if(op->size == 0 && op->type != 'f')
+			continue;
+		if(op->type == 'a') {
+			ptrs[op->id] = alloc->malloc(op->size);
+		} else if(op->type == 'r') {
+			ptrs[op->id] = alloc->realloc(ptrs[op->id], op->size);
+		} else if(ptrs[op->id] != NULL) {
+			alloc->free(ptrs[op->id]);
+			ptrs[op->id] = NULL;
+		}
+	}
+	for(i = 0; i < trace->num_ids; i++) {
+		if(ptrs[i] != NULL) {
+			alloc->free(ptrs[i]);
+			ptrs[i] = NULL;
+		}
+	}
+}
+
+static void run_child(const allocator_t *alloc, const trace_t *trace, int repeat, int fd) {
+	result_t res;
+	struct timespec begin, end;
+	void **ptrs;
+	int r;
+
+	memset(&res, 0, sizeof(res));
+	res.ok = replay_checked(alloc, trace, &res);
+	if(res.ok) {
+		ptrs = table_alloc(trace->num_ids * sizeof(void *));
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		for(r = 0; r < repeat; r++)
+			replay(alloc, trace, ptrs);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		res.secs = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+		table_free(ptrs, trace->num_ids * sizeof(void *));
+	}
+	if(write(fd, &res, sizeof(res)) != sizeof(res))
+		_exit(1);
+	_exit(0);
+}
+
+static int run(const allocator_t *alloc, const trace_t *trace, int repeat, result_t *res) {
+	int fds[2], status;
+	pid_t pid;
+
+	fflush(stdout);
+	if(pipe(fds) != 0)
+		return 0;
+	pid = fork();
+	if(pid == 0) {
+		close(fds[0]);
+		run_child(alloc, trace, repeat, fds[1]);
+	}
+	close(fds[1]);
+	if(pid < 0 || read(fds[0], res, sizeof(*res)) != sizeof(*res))
+		res->ok = 0;
+	close(fds[0]);
+	if(pid > 0)
+		waitpid(pid, &status, 0);
+	return res->ok;
+}
+
+static int is_trace(const struct dirent *entry) {
+	size_t len = strlen(entry->d_name);
+	return len > 4 && strcmp(entry->d_name + len - 4, ".rep") == 0;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-t tracedir] [-f tracefile]... [-a dmm|libc] [-n repeat] [-m] [-v]\n", prog);
+	fprintf(stderr, "  -m  print machine-readable CSV instead of a table\n");
+	fprintf(stderr, "  -v  print the sampled footprint and fragmentation of every trace\n");
+	exit(1);
+}
+
+int main(int argc, char *argv[]) {
+	const char *tracedir = DEFAULT_TRACEDIR;
+	const char *files[MAX_TRACES];
+	const char *only = NULL;
+	trace_t traces[MAX_TRACES];
+	char path[512];
+	int num_files = 0, num_traces = 0, repeat = REPEAT, csv = 0, failed = 0;
+	int opt, i, a;
+
+	while((opt = getopt(argc, argv, "t:f:a:n:mv")) != -1) {
+		switch(opt) {
+		case 't': tracedir = optarg; break;
+		case 'f':
+			if(num_files < MAX_TRACES)
+				files[num_files++] = optarg;
+			break;
+		case 'a': only = optarg; break;
+		case 'n': repeat = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+		case 'm': csv = 1; break;
+		case 'v': verbose = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+
+	if(num_files > 0) {
+		for(i = 0; i < num_files; i++)
+			num_traces += read_trace(files[i], &traces[num_traces]);
+	} else {
+		struct dirent **entries;
+		int n = scandir(tracedir, &entries, is_trace, alphasort);
+		if(n < 0) {
+			perror(tracedir);
+			return 1;
+		}
+		for(i = 0; i < n; i++) {
+			snprintf(path, sizeof(path), "%s/%s", tracedir, entries[i]->d_name);
+			if(num_traces < MAX_TRACES)
+				num_traces += read_trace(path, &traces[num_traces]);
+			free(entries[i]);
+		}
+		free(entries);
+	}
+	if(num_traces == 0) {
+		fprintf(stderr, "no traces to run\n");
+		return 1;
+	}
+
+	if(csv)
+		printf("trace,allocator,ok,ops,secs,kops_per_sec,util,frag_avg,frag_max\n");
+	else
+		printf("%-20s %-6s %8s %10s %10s %6s %9s %9s\n", "trace", "alloc", "ops", "secs", "Kops/s", "util", "frag_avg", "frag_max");
+
+	for(a = 0; a < NUM_ALLOCATORS; a++) {
+		const allocator_t *alloc = &allocators[a];
+		double total_secs = 0.0, total_util = 0.0;
+		long total_ops = 0;
+		int passed = 0;
+
+		if(only != NULL && strcmp(only, alloc->name) != 0)
+			continue;
+		for(i = 0; i < num_traces; i++) {
+			result_t res;
+			long ops = (long) traces[i].num_ops * repeat;
+			if(!run(alloc, &traces[i], repeat, &res)) {
+				failed++;
+				if(csv)
+					printf("%s,%s,0,%ld,,,,,\n", traces[i].name, alloc->name, ops);
+				else
+					printf("%-20s %-6s %8s\n", traces[i].name, alloc->name, "FAILED");
+				continue;
+			}
+			passed++;
+			total_ops += ops;
+			total_secs += res.secs;
+			total_util += res.util;
+			if(csv && res.frag_avg >= 0.0)
+				printf("%s,%s,1,%ld,%.6f,%.1f,%.4f,%.4f,%.4f\n", traces[i].name, alloc->name, ops,
+					res.secs, ops / res.secs / 1e3, res.util, res.frag_avg, res.frag_max);
+			else if(csv)
+				printf("%s,%s,1,%ld,%.6f,%.1f,%.4f,,\n", traces[i].name, alloc->name, ops,
+					res.secs, ops / res.secs / 1e3, res.util);
+			else if(res.frag_avg >= 0.0)
+				printf("%-20s %-6s %8ld %10.6f %10.1f %5.1f%% %9.3f %9.3f\n", traces[i].name, alloc->name, ops,
+					res.secs, ops / res.secs / 1e3, 100.0 * res.util, res.frag_avg, res.frag_max);
+			else
+				printf("%-20s %-6s %8ld %10.6f %10.1f %5.1f%% %9s %9s\n", traces[i].name, alloc->name, ops,
+					res.secs, ops / res.secs / 1e3, 100.0 * res.util, "-", "-");
+		}
+		if(passed > 0) {
+			if(csv)
+				printf("TOTAL,%s,1,%ld,%.6f,%.1f,%.4f,,\n", alloc->name, total_ops, total_secs,
+					total_ops / total_secs / 1e3, total_util / passed);
+			else
+				printf("%-20s %-6s %8ld %10.6f %10.1f %5.1f%%\n", "TOTAL", alloc->name, total_ops, total_secs,
+					total_ops / total_secs / 1e3, 100.0 * total_util / passed);
+		}
+	}
+
+	for(i = 0; i < num_traces; i++)
+		table_free(traces[i].ops, traces[i].ops_bytes);
+	return failed ? 1 : 0;
+}
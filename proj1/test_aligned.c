@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "dmm.h"
+
+/* Interleaves aligned and plain allocations of various sizes, checking the
+ * alignment and that no two live blocks overlap, then frees them in a
+ * different order so the split-off gaps get coalesced again.
+ */
+
+#define NOBJS (512)
+
+int main(int argc, char *argv[]) {
+	unsigned char *ptr[NOBJS];
+	size_t sizes[NOBJS];
+	size_t alignment;
+	void *p;
+	int i, j;
+
+	for(i = 0; i < NOBJS; i++) {
+		alignment = (size_t) 16 << (i % 9); /* 16 bytes up to 4 kB */
+		sizes[i] = 1 + (i * 37) % 3000;
+		if(i % 3 == 0) {
+			ptr[i] = dmalloc(sizes[i]);
+		} else if(i % 3 == 1) {
+			ptr[i] = daligned_alloc(alignment, sizes[i]);
+			if(ptr[i] == NULL) {
+				fprintf(stderr, "call to daligned_alloc() failed\n");
+				exit(1);
+			}
+			if(((uintptr_t) ptr[i] & (alignment - 1)) != 0) {
+				fprintf(stderr, "daligned_alloc returned a misaligned block\n");
+				exit(1);
+			}
+		} else {
+			if(dposix_memalign(&p, alignment, sizes[i]) != 0) {
+				fprintf(stderr, "call to dposix_memalign() failed\n");
+				exit(1);
+			}
+			ptr[i] = p;
+			if(((uintptr_t) ptr[i] & (alignment - 1)) != 0) {
+				fprintf(stderr, "dposix_memalign returned a misaligned block\n");
+				exit(1);
+			}
+		}
+		if(ptr[i] == NULL) {
+			fprintf(stderr, "allocation failed\n");
+			exit(1);
+		}
+		memset(ptr[i], i & 0xff, sizes[i]);
+	}
+
+	for(i = 0; i < NOBJS; i++) {
+		for(j = 0; j < (int) sizes[i]; j++) {
+			if(ptr[i][j] != (i & 0xff)) {
+				fprintf(stderr, "aligned block overwritten\n");
+				exit(1);
+			}
+		}
+	}
+
+	if(dposix_memalign(&p, 24, 100) != EINVAL) {
+		fprintf(stderr, "non power of two alignment should be rejected\n");
+		exit(1);
+	}
+	if(daligned_alloc(48, 100) != NULL) {
+		fprintf(stderr, "non power of two alignment should be rejected\n");
+		exit(1);
+	}
+
+	for(i = 0; i < NOBJS; i += 2) {
+		dfree(ptr[i]);
+	}
+	for(i = 1; i < NOBJS; i += 2) {
+		dfree(ptr[i]);
+	}
+
+	printf("Aligned allocation testcases passed!\n");
+	return 0;
+}
@@ -63,6 +63,18 @@ int main(int argc, char *argv[])
 	printf("calling free(945)\n");	
 	dfree(array3);
 
+	printf("calling malloc(0)\n");
+	array1 = (char*)dmalloc(0);
+	if(array1 == NULL)
+	{
+		fprintf(stderr,"call to dmalloc(0) failed\n");
+		fflush(stderr);
+		exit(1);
+	}
+	array1[0] = 'd';
+	printf("calling free(0)\n");
+	dfree(array1);
+
 	printf("Basic testcases passed!\n");
 
 	return(0);
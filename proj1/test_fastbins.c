@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dmm.h"
+
+/* Exercises the fast bins of a -DDMM_FASTBINS build: a freed block comes
+ * straight back for the next request of its size, parked neighbours are
+ * merged once a request cannot be served otherwise, and a long ping-pong
+ * of request-sized buffers leaves the heap consistent.
+ */
+
+#define NBLOCKS (8)
+
+#define BLOCK_PAYLOAD (FASTBIN_MAX_SIZE / 2)
+
+#define ROUNDS (100000)
+
+int main(int argc, char *argv[]) {
+	void *ptr[NBLOCKS];
+	void *first, *again, *big;
+	int i, j;
+
+	/* Same-size ping-pong reuses the parked block */
+	first = dmalloc(BLOCK_PAYLOAD);
+	if(first == NULL) {
+		fprintf(stderr, "dmalloc failed\n");
+		exit(1);
+	}
+	dfree(first);
+	again = dmalloc(BLOCK_PAYLOAD);
+	if(again != first) {
+		fprintf(stderr, "freed block was not reused for the same size\n");
+		exit(1);
+	}
+	dfree(again);
+
+	/* Adjacent parked blocks merge when a larger request misses */
+	for(i = 0; i < NBLOCKS; i++) {
+		ptr[i] = dmalloc(BLOCK_PAYLOAD);
+		if(ptr[i] == NULL) {
+			fprintf(stderr, "dmalloc failed\n");
+			exit(1);
+		}
+		memset(ptr[i], i, BLOCK_PAYLOAD);
+	}
+	for(i = 0; i < NBLOCKS; i++)
+		dfree(ptr[i]);
+	if(!dmm_check_heap()) {
+		fprintf(stderr, "heap check failed with parked blocks\n");
+		exit(1);
+	}
+	big = dmalloc(NBLOCKS * BLOCK_PAYLOAD);
+	if(big == NULL) {
+		fprintf(stderr, "dmalloc failed\n");
+		exit(1);
+	}
+	if(big != ptr[0]) {
+		fprintf(stderr, "parked neighbours were not coalesced\n");
+		exit(1);
+	}
+	dfree(big);
+	printf("parked blocks reused and coalesced\n");
+
+	/* Request/response loop over a few common sizes */
+	for(i = 0; i < ROUNDS; i++) {
+		for(j = 0; j < NBLOCKS; j++) {
+			ptr[j] = dmalloc(64 + ((i + j) % 8) * 56);
+			if(ptr[j] == NULL) {
+				fprintf(stderr, "dmalloc failed\n");
+				exit(1);
+			}
+			memset(ptr[j], j, 64);
+		}
+		for(j = NBLOCKS - 1; j >= 0; j--)
+			dfree(ptr[j]);
+	}
+	if(!dmm_check_heap()) {
+		fprintf(stderr, "heap check failed after the ping-pong loop\n");
+		exit(1);
+	}
+
+	printf("Fast bin testcases passed!\n");
+	return 0;
+}
@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "dmm.h"
+
+/* Runs a mixed workload on the hardened build, checking the heap as it goes,
+ * then provokes each kind of misuse in a child process and expects the
+ * allocator to abort it.
+ */
+
+#define NOBJS (512)
+#define ROUNDS (20000)
+
+static void double_free_heap() {
+	void *p = dmalloc(200);
+	dfree(p);
+	dfree(p);
+}
+
+static void double_free_slab() {
+	void *p = dmalloc(16);
+	dfree(p);
+	dfree(p);
+}
+
+static void overflow() {
+	char *p = dmalloc(200);
+	memset(p, 'x', dmalloc_usable_size(p) + 1);
+	dfree(p);
+}
+
+static void overflow_seen_by_check() {
+	char *p = dmalloc(200);
+	memset(p, 'x', dmalloc_usable_size(p) + 1);
+	exit(dmm_check_heap() ? 0 : SIGABRT); /* report like an abort */
+}
+
+static void write_after_free() {
+	int i;
+	char *p = dmalloc(300);
+	dfree(p);
+	p[3] = 1;
+	for(i = 0; i < QUARANTINE_BLOCKS + 1; i++)
+		dfree(dmalloc(300));
+}
+
+static void invalid_pointer() {
+	char *p = dcalloc(1, 300);
+	dfree(p + 64);
+}
+
+/* Returns whether fn killed its process with SIGABRT, or exited with that code */
+static int aborts(void (*fn)()) {
+	int status;
+	pid_t pid = fork();
+	if(pid == 0) {
+		freopen("/dev/null", "w", stderr);
+		fn();
+		exit(0);
+	}
+	waitpid(pid, &status, 0);
+	return (WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT) || (WIFEXITED(status) && WEXITSTATUS(status) == SIGABRT);
+}
+
+int main(int argc, char *argv[]) {
+	unsigned char *ptr[NOBJS];
+	size_t sizes[NOBJS];
+	int i, j, round;
+
+	memset(ptr, 0, sizeof(ptr));
+	srandom(1);
+	for(round = 0; round < ROUNDS; round++) {
+		i = random() % NOBJS;
+		if(ptr[i] == NULL) {
+			sizes[i] = 1 + random() % (round % 7 == 0 ? 20000 : 600);
+			switch(random() % 3) {
+			case 0: ptr[i] = dmalloc(sizes[i]); break;
+			case 1: ptr[i] = dcalloc(1, sizes[i]); break;
+			default: ptr[i] = daligned_alloc(64, sizes[i]); break;
+			}
+			if(ptr[i] == NULL) {
+				fprintf(stderr, "allocation failed\n");
+				exit(1);
+			}
+			memset(ptr[i], i, sizes[i]);
+		} else if(random() % 4 == 0) {
+			size_t size = 1 + random() % 3000;
+			ptr[i] = drealloc(ptr[i], size);
+			if(ptr[i] == NULL) {
+				fprintf(stderr, "call to drealloc() failed\n");
+				exit(1);
+			}
+			for(j = 0; j < (int) (size < sizes[i] ? size : sizes[i]); j++) {
+				if(ptr[i][j] != (unsigned char) i) {
+					fprintf(stderr, "drealloc lost data\n");
+					exit(1);
+				}
+			}
+			sizes[i] = size;
+			memset(ptr[i], i, size);
+		} else {
+			for(j = 0; j < (int) sizes[i]; j++) {
+				if(ptr[i][j] != (unsigned char) i) {
+					fprintf(stderr, "block contents changed\n");
+					exit(1);
+				}
+			}
+			dfree(ptr[i]);
+			ptr[i] = NULL;
+		}
+		if(round % 1000 == 0 && !dmm_check_heap()) {
+			fprintf(stderr, "dmm_check_heap() failed on a healthy heap\n");
+			exit(1);
+		}
+	}
+	for(i = 0; i < NOBJS; i++) {
+		if(ptr[i] != NULL)
+			dfree(ptr[i]);
+	}
+	if(!dmm_check_heap()) {
+		fprintf(stderr, "dmm_check_heap() failed after freeing everything\n");
+		exit(1);
+	}
+
+	if(!aborts(double_free_heap)) {
+		fprintf(stderr, "double free of a heap block not caught\n");
+		exit(1);
+	}
+	if(!aborts(double_free_slab)) {
+		fprintf(stderr, "double free of a slab slot not caught\n");
+		exit(1);
+	}
+	if(!aborts(overflow)) {
+		fprintf(stderr, "overflow into the canary not caught\n");
+		exit(1);
+	}
+	if(!aborts(overflow_seen_by_check)) {
+		fprintf(stderr, "dmm_check_heap() missed a damaged canary\n");
+		exit(1);
+	}
+	if(!aborts(write_after_free)) {
+		fprintf(stderr, "write after free not caught\n");
+		exit(1);
+	}
+	if(!aborts(invalid_pointer)) {
+		fprintf(stderr, "free of an interior pointer not caught\n");
+		exit(1);
+	}
+
+	printf("Hardened testcases passed!\n");
+	return 0;
+}
@@ -0,0 +1,88 @@
+#define _GNU_SOURCE // needed for RTLD_DEFAULT
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <dlfcn.h>
+
+/* Runs the standard allocation calls on libdmm.so, re-executing itself with
+ * LD_PRELOAD=./libdmm.so when started without it. Ordinary requests must
+ * work, and requests too large to ever satisfy must fail with ENOMEM
+ * instead of wrapping around to a small size.
+ */
+
+/* The result must be NULL with errno set to ENOMEM */
+static void expect_enomem(void *ptr, const char *call) {
+	if(ptr != NULL || errno != ENOMEM) {
+		fprintf(stderr, "%s: expected NULL with ENOMEM\n", call);
+		exit(1);
+	}
+	errno = 0;
+}
+
+int main(int argc, char *argv[]) {
+	size_t huge[] = { SIZE_MAX, SIZE_MAX - 1, SIZE_MAX - 6, SIZE_MAX - 7, SIZE_MAX - 15, (size_t) PTRDIFF_MAX + 1 };
+	volatile size_t count = SIZE_MAX / 2; // hidden from the compiler's size checks
+	void *ptr, *grown;
+	int i;
+
+	if(dlsym(RTLD_DEFAULT, "dmalloc") == NULL) {
+		setenv("LD_PRELOAD", "./libdmm.so", 1);
+		execv(argv[0], argv);
+		fprintf(stderr, "could not re-execute with LD_PRELOAD=./libdmm.so\n");
+		exit(1);
+	}
+
+	ptr = malloc(100);
+	if(ptr == NULL) {
+		fprintf(stderr, "malloc failed\n");
+		exit(1);
+	}
+	memset(ptr, 1, 100);
+	grown = realloc(ptr, 100000);
+	if(grown == NULL || ((unsigned char *) grown)[99] != 1) {
+		fprintf(stderr, "realloc lost the data\n");
+		exit(1);
+	}
+	free(grown);
+	ptr = calloc(10, 10);
+	if(ptr == NULL || ((unsigned char *) ptr)[99] != 0) {
+		fprintf(stderr, "calloc failed\n");
+		exit(1);
+	}
+	free(ptr);
+
+	ptr = malloc(64);
+	for(i = 0; i < (int) (sizeof(huge) / sizeof(huge[0])); i++) {
+		errno = 0;
+		expect_enomem(malloc(huge[i]), "malloc");
+		expect_enomem(calloc(1, huge[i]), "calloc");
+		expect_enomem(realloc(NULL, huge[i]), "realloc(NULL)");
+		expect_enomem(realloc(ptr, huge[i]), "realloc");
+		expect_enomem(aligned_alloc(64, huge[i]), "aligned_alloc");
+		expect_enomem(memalign(4096, huge[i]), "memalign");
+		expect_enomem(valloc(huge[i]), "valloc");
+		expect_enomem(pvalloc(huge[i]), "pvalloc");
+		void *aligned = NULL;
+		if(posix_memalign(&aligned, 64, huge[i]) != ENOMEM) {
+			fprintf(stderr, "posix_memalign: expected ENOMEM\n");
+			exit(1);
+		}
+	}
+	errno = 0;
+	expect_enomem(calloc(count, 3), "calloc overflow");
+	/* A failed realloc leaves the block alone */
+	memset(ptr, 7, 64);
+	if(((unsigned char *) ptr)[63] != 7) {
+		fprintf(stderr, "block damaged\n");
+		exit(1);
+	}
+	free(ptr);
+	printf("oversized requests fail with ENOMEM\n");
+
+	printf("Preload testcases passed!\n");
+	return 0;
+}
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dmm.h"
+
+/* Grows a buffer step by step, checking its contents survive and that it is
+ * grown in place while the space after it is free, then shrinks it and checks
+ * dcalloc hands back zeroed memory even when it reuses dirty blocks.
+ */
+
+#define STEPS (64)
+
+#define STEP_SIZE (1000)
+
+static void check(unsigned char *buf, int len) {
+	int i;
+	for(i = 0; i < len; i++) {
+		if(buf[i] != (unsigned char) i) {
+			fprintf(stderr, "byte %d of %p lost\n", i, buf);
+			exit(1);
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	unsigned char *buf, *grown, *zeroed;
+	int i, len = 0, moved = 0;
+
+	/* The first request is bigger than the initial heap, which grows in place
+	 * around the old epilogue; no bookkeeping word may leak into the block */
+	zeroed = dcalloc(1, 100000);
+	if(zeroed == NULL) {
+		fprintf(stderr, "call to dcalloc() failed\n");
+		exit(1);
+	}
+	for(i = 0; i < 100000; i++) {
+		if(zeroed[i] != 0) {
+			fprintf(stderr, "dcalloc returned a heap bookkeeping word\n");
+			exit(1);
+		}
+	}
+	dfree(zeroed);
+
+	buf = drealloc(NULL, STEP_SIZE);
+	if(buf == NULL) {
+		fprintf(stderr, "call to drealloc(NULL) failed\n");
+		exit(1);
+	}
+	for(i = 1; i <= STEPS; i++) {
+		grown = drealloc(buf, i * STEP_SIZE);
+		if(grown == NULL) {
+			fprintf(stderr, "call to drealloc() failed\n");
+			exit(1);
+		}
+		if(grown != buf)
+			moved++;
+		buf = grown;
+		check(buf, len);
+		for(; len < i * STEP_SIZE; len++) {
+			buf[len] = (unsigned char) len;
+		}
+	}
+	printf("grew to %d bytes, moved %d times\n", len, moved);
+	if(moved != 0) {
+		fprintf(stderr, "buffer at the top of the heap should grow in place\n");
+		exit(1);
+	}
+
+	grown = drealloc(buf, STEP_SIZE);
+	if(grown != buf) {
+		fprintf(stderr, "shrinking should never move the buffer\n");
+		exit(1);
+	}
+	check(buf, STEP_SIZE);
+
+	/* The tail given back by the shrink is dirty; dcalloc must still zero it */
+	zeroed = dcalloc(STEPS, STEP_SIZE);
+	if(zeroed == NULL) {
+		fprintf(stderr, "call to dcalloc() failed\n");
+		exit(1);
+	}
+	for(i = 0; i < STEPS * STEP_SIZE; i++) {
+		if(zeroed[i] != 0) {
+			fprintf(stderr, "dcalloc returned dirty memory\n");
+			exit(1);
+		}
+	}
+	memset(zeroed, 0xff, STEPS * STEP_SIZE);
+	dfree(zeroed);
+	zeroed = dcalloc(STEPS, STEP_SIZE);
+	if(zeroed == NULL) {
+		fprintf(stderr, "call to dcalloc() failed\n");
+		exit(1);
+	}
+	for(i = 0; i < STEPS * STEP_SIZE; i++) {
+		if(zeroed[i] != 0) {
+			fprintf(stderr, "dcalloc reused a block without zeroing it\n");
+			exit(1);
+		}
+	}
+	dfree(zeroed);
+
+	/* Large buffers are mapped separately and moved with their contents */
+	buf = dmalloc(STEP_SIZE);
+	if(buf == NULL) {
+		fprintf(stderr, "call to dmalloc() failed\n");
+		exit(1);
+	}
+	for(i = 0; i < STEP_SIZE; i++) {
+		buf[i] = (unsigned char) i;
+	}
+	for(len = MMAP_THRESHOLD; len <= 8 * MMAP_THRESHOLD; len *= 2) {
+		buf = drealloc(buf, len);
+		if(buf == NULL) {
+			fprintf(stderr, "call to drealloc() failed for a mapped block\n");
+			exit(1);
+		}
+		check(buf, STEP_SIZE);
+	}
+	buf = drealloc(buf, STEP_SIZE);
+	if(buf == NULL) {
+		fprintf(stderr, "call to drealloc() failed when leaving the mapping\n");
+		exit(1);
+	}
+	check(buf, STEP_SIZE);
+	dfree(buf);
+	zeroed = dcalloc(1, MMAP_THRESHOLD);
+	if(zeroed == NULL) {
+		fprintf(stderr, "call to dcalloc() failed for a mapped block\n");
+		exit(1);
+	}
+	for(i = 0; i < MMAP_THRESHOLD; i++) {
+		if(zeroed[i] != 0) {
+			fprintf(stderr, "mapped dcalloc returned dirty memory\n");
+			exit(1);
+		}
+	}
+	dfree(zeroed);
+
+	/* Small buffers and overflowing requests */
+	zeroed = dcalloc(4, 4);
+	if(zeroed == NULL) {
+		fprintf(stderr, "call to dcalloc() failed\n");
+		exit(1);
+	}
+	for(i = 0; i < 16; i++) {
+		if(zeroed[i] != 0) {
+			fprintf(stderr, "small dcalloc returned dirty memory\n");
+			exit(1);
+		}
+	}
+	dfree(zeroed);
+	if(dcalloc((size_t) -1, 16) != NULL) {
+		fprintf(stderr, "overflowing dcalloc should fail\n");
+		exit(1);
+	}
+	if(drealloc(buf, 0) != NULL) {
+		fprintf(stderr, "drealloc to zero bytes should free\n");
+		exit(1);
+	}
+
+	printf("Realloc testcases passed!\n");
+	return 0;
+}
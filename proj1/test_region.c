@@ -0,0 +1,127 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "dmm.h"
+
+/* Fills a region with objects of mixed sizes, checks nested scopes release
+ * only what was allocated inside them, and that reset and destroy hand every
+ * chunk back. Then times a request loop served by a region against freeing
+ * each object with dfree.
+ */
+
+#define NOBJS (4000)
+
+#define REQUESTS (2000)
+
+#define OBJS_PER_REQUEST (50)
+
+static size_t in_use() {
+	dmm_stats_t stats;
+	dmm_get_stats(&stats);
+	return stats.in_use;
+}
+
+int main(int argc, char *argv[]) {
+	static unsigned char *ptr[NOBJS];
+	static void *objs[OBJS_PER_REQUEST];
+	dmm_region_t *region;
+	size_t base, size;
+	clock_t begin;
+	double regionTime, freeTime;
+	int i, j, r;
+
+	dmalloc_init();
+	base = in_use();
+	region = dmm_region_create(0);
+	if(region == NULL) {
+		fprintf(stderr, "dmm_region_create failed\n");
+		exit(1);
+	}
+
+	for(i = 0; i < NOBJS; i++) {
+		size = 1 + (i * 37) % 300;
+		if(i == NOBJS / 2) {
+			/* Inner scope for the second half */
+			if(!dmm_region_begin(region)) {
+				fprintf(stderr, "dmm_region_begin failed\n");
+				exit(1);
+			}
+		}
+		if(i % 500 == 0)
+			size = 3 * DMM_REGION_CHUNK_SIZE;
+		ptr[i] = dmm_region_alloc(region, size);
+		if(ptr[i] == NULL) {
+			fprintf(stderr, "dmm_region_alloc failed\n");
+			exit(1);
+		}
+		if(((size_t) ptr[i] & (ALIGNMENT - 1)) != 0) {
+			fprintf(stderr, "region object is misaligned\n");
+			exit(1);
+		}
+		memset(ptr[i], i & 0xff, size < 64 ? size : 64);
+	}
+	for(i = 0; i < NOBJS; i++) {
+		size = 1 + (i * 37) % 300;
+		for(j = 0; j < (int) (size < 64 ? size : 64); j++) {
+			if(ptr[i][j] != (i & 0xff)) {
+				fprintf(stderr, "region objects overlap\n");
+				exit(1);
+			}
+		}
+	}
+
+	size = in_use();
+	dmm_region_end(region);
+	if(in_use() >= size) {
+		fprintf(stderr, "ending a scope released nothing\n");
+		exit(1);
+	}
+	for(i = 0; i < NOBJS / 2; i++) {
+		if(ptr[i][0] != (i & 0xff)) {
+			fprintf(stderr, "ending a scope damaged objects from before it\n");
+			exit(1);
+		}
+	}
+	dmm_region_reset(region);
+	/* Only the region itself and one spare chunk may be left */
+	if(in_use() - base > DMM_REGION_CHUNK_SIZE + 256) {
+		fprintf(stderr, "reset kept more than one spare chunk\n");
+		exit(1);
+	}
+	dmm_region_destroy(region);
+	if(in_use() != base) {
+		fprintf(stderr, "destroy did not release every chunk\n");
+		exit(1);
+	}
+	if(!dmm_check_heap()) {
+		fprintf(stderr, "heap check failed\n");
+		exit(1);
+	}
+	printf("nested scopes and reset release their chunks\n");
+
+	/* Request-scoped data: a region per loop iteration versus one dfree per object */
+	region = dmm_region_create(0);
+	begin = clock();
+	for(r = 0; r < REQUESTS; r++) {
+		dmm_region_begin(region);
+		for(j = 0; j < OBJS_PER_REQUEST; j++)
+			objs[j] = dmm_region_alloc(region, 16 + (j * 24) % 400);
+		dmm_region_end(region);
+	}
+	regionTime = (double) (clock() - begin) / CLOCKS_PER_SEC;
+	dmm_region_destroy(region);
+	begin = clock();
+	for(r = 0; r < REQUESTS; r++) {
+		for(j = 0; j < OBJS_PER_REQUEST; j++)
+			objs[j] = dmalloc(16 + (j * 24) % 400);
+		for(j = 0; j < OBJS_PER_REQUEST; j++)
+			dfree(objs[j]);
+	}
+	freeTime = (double) (clock() - begin) / CLOCKS_PER_SEC;
+	printf("Requests: %d of %d objects, region: %g seconds, dmalloc/dfree: %g seconds\n", REQUESTS, OBJS_PER_REQUEST, regionTime, freeTime);
+
+	printf("Region testcases passed!\n");
+	return 0;
+}
@@ -0,0 +1,67 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dmm.h"
+
+/* Fills the slab sizes with many live objects, checks none of them overlap,
+ * frees every other one and makes sure the holes are reused.
+ */
+
+#define NOBJS (20000)
+
+#define MAX_OBJ_SIZE (SLAB_MAX_SIZE)
+
+int main(int argc, char *argv[]) {
+	static unsigned char *ptr[NOBJS];
+	int i, j, size;
+
+	for(i = 0; i < NOBJS; i++) {
+		size = 1 + i % MAX_OBJ_SIZE;
+		ptr[i] = dmalloc(size);
+		if(ptr[i] == NULL) {
+			fprintf(stderr, "call to dmalloc(%d) failed\n", size);
+			exit(1);
+		}
+		memset(ptr[i], i & 0xff, size);
+	}
+
+	for(i = 0; i < NOBJS; i++) {
+		size = 1 + i % MAX_OBJ_SIZE;
+		for(j = 0; j < size; j++) {
+			if(ptr[i][j] != (i & 0xff)) {
+				fprintf(stderr, "object %d at %p overwritten\n", i, ptr[i]);
+				exit(1);
+			}
+		}
+	}
+	printf("%d small objects allocated and verified\n", NOBJS);
+
+	for(i = 0; i < NOBJS; i += 2) {
+		dfree(ptr[i]);
+	}
+	for(i = 0; i < NOBJS; i += 2) {
+		size = 1 + i % MAX_OBJ_SIZE;
+		ptr[i] = dmalloc(size);
+		if(ptr[i] == NULL) {
+			fprintf(stderr, "call to dmalloc(%d) failed\n", size);
+			exit(1);
+		}
+		memset(ptr[i], i & 0xff, size);
+	}
+	for(i = 1; i < NOBJS; i += 2) {
+		size = 1 + i % MAX_OBJ_SIZE;
+		for(j = 0; j < size; j++) {
+			if(ptr[i][j] != (i & 0xff)) {
+				fprintf(stderr, "object %d at %p overwritten\n", i, ptr[i]);
+				exit(1);
+			}
+		}
+	}
+	for(i = 0; i < NOBJS; i++) {
+		dfree(ptr[i]);
+	}
+
+	printf("Slab testcases passed!\n");
+	return 0;
+}
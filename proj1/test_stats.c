@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dmm.h"
+
+/* Checks that dmm_get_stats tracks live bytes, the peak, large mappings and
+ * the allocation histogram as blocks of every kind come and go.
+ */
+
+#define NOBJS (256)
+
+int main(int argc, char *argv[]) {
+	void *ptr[NOBJS];
+	void *big;
+	dmm_stats_t before, stats;
+	size_t allocs_before, allocs;
+	int i;
+
+	dmm_get_stats(&before);
+	allocs_before = 0;
+	for(i = 0; i < NUM_SIZE_CLASSES; i++)
+		allocs_before += before.alloc_hist[i];
+
+	for(i = 0; i < NOBJS; i++) {
+		ptr[i] = dmalloc(1 + (i * 131) % 4000);
+		if(ptr[i] == NULL) {
+			fprintf(stderr, "call to dmalloc() failed\n");
+			exit(1);
+		}
+		memset(ptr[i], i, 1 + (i * 131) % 4000);
+	}
+	big = dmalloc(4 * MMAP_THRESHOLD);
+	if(big == NULL) {
+		fprintf(stderr, "large dmalloc() failed\n");
+		exit(1);
+	}
+
+	dmm_get_stats(&stats);
+	if(stats.in_use < before.in_use + 4 * MMAP_THRESHOLD) {
+		fprintf(stderr, "in_use does not cover the live blocks\n");
+		exit(1);
+	}
+	if(stats.peak_in_use < stats.in_use) {
+		fprintf(stderr, "peak is below the current usage\n");
+		exit(1);
+	}
+	if(stats.mmap_bytes < before.mmap_bytes + 4 * MMAP_THRESHOLD) {
+		fprintf(stderr, "large block not counted as mapped\n");
+		exit(1);
+	}
+	if(stats.heap_bytes == 0) {
+		fprintf(stderr, "no heap memory reported\n");
+		exit(1);
+	}
+	allocs = 0;
+	for(i = 0; i < NUM_SIZE_CLASSES; i++)
+		allocs += stats.alloc_hist[i];
+	if(allocs < allocs_before + NOBJS) {
+		fprintf(stderr, "allocation histogram missed blocks\n");
+		exit(1);
+	}
+
+	for(i = 0; i < NOBJS; i += 2)
+		dfree(ptr[i]);
+	dfree(big);
+
+	dmm_get_stats(&before);
+	if(before.in_use >= stats.in_use) {
+		fprintf(stderr, "in_use did not drop after frees\n");
+		exit(1);
+	}
+	if(before.peak_in_use != stats.peak_in_use) {
+		fprintf(stderr, "peak changed after frees\n");
+		exit(1);
+	}
+	if(before.mmap_bytes + 4 * MMAP_THRESHOLD > stats.mmap_bytes) {
+		fprintf(stderr, "mapping not released\n");
+		exit(1);
+	}
+	if(before.largest_free > before.free_bytes) {
+		fprintf(stderr, "largest free block exceeds free bytes\n");
+		exit(1);
+	}
+	if(before.fragmentation < 0.0 || before.fragmentation > 1.0) {
+		fprintf(stderr, "fragmentation out of range\n");
+		exit(1);
+	}
+
+	for(i = 1; i < NOBJS; i += 2)
+		dfree(ptr[i]);
+	if(!dmm_check_heap()) {
+		fprintf(stderr, "dmm_check_heap() found problems\n");
+		exit(1);
+	}
+
+	dmm_print_stats();
+	dmm_profile_dump();
+	printf("Stats testcases passed!\n");
+	return 0;
+}
@@ -0,0 +1,111 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "dmm.h"
+
+/* Each thread churns its own set of small blocks; the total amount of work
+ * grows with the thread count, so ideal scaling keeps the time constant.
+ */
+
+#define BUFLEN (256)
+
+#define LOOPCNT (1000000)
+
+#define MAX_ALLOC_SIZE (1024)
+
+#define MAX_THREADS (16)
+
+static int failed = 0;
+
+static void *worker(void *arg) {
+	unsigned int seed = (unsigned int)(long)arg;
+	unsigned char *ptr[BUFLEN];
+	int sizes[BUFLEN];
+	int i, j, itr;
+
+	for(i = 0; i < BUFLEN; i++) {
+		ptr[i] = NULL;
+	}
+
+	for(i = 0; i < LOOPCNT; i++) {
+		itr = rand_r(&seed) % BUFLEN;
+		if(ptr[itr] == NULL) {
+			sizes[itr] = 1 + rand_r(&seed) % MAX_ALLOC_SIZE;
+			ptr[itr] = dmalloc(sizes[itr]);
+			if(ptr[itr] == NULL) {
+				__sync_fetch_and_add(&failed, 1);
+				continue;
+			}
+			memset(ptr[itr], itr & 0xff, sizes[itr]);
+		} else {
+			/* Blocks shared with another thread would show up as clobbered bytes */
+			for(j = 0; j < sizes[itr]; j++) {
+				if(ptr[itr][j] != (itr & 0xff)) {
+					fprintf(stderr, "block %p corrupted\n", ptr[itr]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			dfree(ptr[itr]);
+			ptr[itr] = NULL;
+		}
+	}
+
+	for(i = 0; i < BUFLEN; i++) {
+		if(ptr[i] != NULL) {
+			dfree(ptr[i]);
+		}
+	}
+	return NULL;
+}
+
+static double run(int nthreads) {
+	pthread_t threads[MAX_THREADS];
+	struct timespec begin, end;
+	long i;
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for(i = 0; i < nthreads; i++) {
+		pthread_create(&threads[i], NULL, worker, (void *)(i + 1));
+	}
+	for(i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+	int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int nthreads;
+	double time_spent, base = 0;
+
+	/* Always run a few threads so the locking is exercised even on one core */
+	if(argc > 1)
+		ncpus = atoi(argv[1]);
+	else if(ncpus < 4)
+		ncpus = 4;
+	if(ncpus > MAX_THREADS)
+		ncpus = MAX_THREADS;
+
+	printf("Test case summary\n");
+	for(nthreads = 1; nthreads <= ncpus; nthreads *= 2) {
+		time_spent = run(nthreads);
+		if(nthreads == 1)
+			base = LOOPCNT / time_spent;
+		printf("Threads: %d, ops: %d, execution time: %g seconds, throughput: %g ops/sec, speedup: %.2fx\n",
+			nthreads, nthreads * LOOPCNT, time_spent, nthreads * LOOPCNT / time_spent,
+			nthreads * LOOPCNT / time_spent / base);
+	}
+
+	if(failed) {
+		printf("malloc failed: %d\n", failed);
+		exit(EXIT_FAILURE);
+	}
+	printf("Thread testcases passed!\n");
+	return 0;
+}
@@ -79,6 +79,7 @@ void *cashier(void *arg) {
 		}
 		thread_unlock(boardLock);
 	}
+	return NULL;
 }
 
 //Maker thread
@@ -131,6 +132,7 @@ void *maker(void *arg) {
 	}
 	//Free board
 	free(board);
+	return NULL;
 }
 
 int main(int argc, char *argv[]) {
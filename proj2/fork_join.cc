@@ -0,0 +1,83 @@
+#include <cstdlib>
+#include <iostream>
+#include <time.h>
+#include "thread.h"
+using namespace std;
+
+//Fork-join example: sums an array by splitting it in halves, one joinable
+//thread per half, down to ranges of CUTOFF elements. Each thread hands its
+//partial sum back as its exit value. Run with THREAD_WORKERS=n to spread the
+//threads over n kernel threads.
+//Usage: fork_join [elements] [repetitions]
+
+#define CUTOFF 1024 //Ranges this small are summed directly
+
+long *numbers; //Array to sum
+
+//Range of the array for one thread
+struct range_t {
+	long first;
+	long last;
+};
+
+void sum(void *a) {
+	range_t *range = (range_t*) a;
+	long total = 0;
+	if(range->last - range->first <= CUTOFF) {
+		for(long i = range->first; i < range->last; i++) {
+			total += numbers[i];
+		}
+		thread_exit((void*) total);
+	}
+	long middle = (range->first + range->last) / 2;
+	range_t halves[2] = {{range->first, middle}, {middle, range->last}};
+	thread_handle_t handles[2];
+	for(int i = 0; i < 2; i++) {
+		if(thread_create_joinable((thread_startfunc_t) sum, &halves[i], NULL, &handles[i]) == -1) {
+			cout << "thread_create_joinable failed" << endl;
+			exit(1);
+		}
+	}
+	for(int i = 0; i < 2; i++) {
+		void *partial;
+		thread_join(handles[i], &partial);
+		total += (long) partial;
+	}
+	thread_exit((void*) total);
+}
+
+void root(void *a) {
+	long elements = ((long*) a)[0];
+	long repetitions = ((long*) a)[1];
+	numbers = new long[elements];
+	for(long i = 0; i < elements; i++) {
+		numbers[i] = i;
+	}
+	struct timespec begin, end;
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	for(long r = 0; r < repetitions; r++) {
+		range_t all = {0, elements};
+		thread_handle_t handle;
+		void *total;
+		thread_create_joinable((thread_startfunc_t) sum, &all, NULL, &handle);
+		thread_join(handle, &total);
+		if((long) total != elements * (elements - 1) / 2) {
+			cout << "wrong sum " << (long) total << endl;
+			exit(1);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double elapsed = end.tv_sec - begin.tv_sec + (end.tv_nsec - begin.tv_nsec) / 1e9;
+	cout << repetitions << " sums of " << elements << " elements in " << elapsed << " seconds" << endl;
+}
+
+int main(int argc, char *argv[]) {
+	long args[2] = {1 << 20, 20};
+	if(argc > 1) {
+		args[0] = atol(argv[1]);
+	}
+	if(argc > 2) {
+		args[1] = atol(argv[2]);
+	}
+	thread_libinit((thread_startfunc_t) root, args);
+}
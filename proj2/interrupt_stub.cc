@@ -0,0 +1,56 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+#include "interrupt.h"
+
+//Stand-in for the course's interrupt library, for building the tests without
+//it. Like the real one it keeps a single interrupt mask for the whole process
+//and asserts that it is never disabled or enabled twice in a row. It also
+//aborts if a second kernel thread uses it, which the thread library must
+//never do with more than one worker. It generates no interrupts, so
+//start_preemptions does nothing.
+
+static volatile bool disabled = false; //The simulated interrupt mask
+static pthread_t owner; //Kernel thread that first used the mask
+static bool owned = false;
+
+static void checkOwner() {
+	if(!owned) {
+		owner = pthread_self();
+		owned = true;
+	}
+	else if(!pthread_equal(owner, pthread_self())) {
+		fprintf(stderr, "interrupt layer used from a second kernel thread\n");
+		abort();
+	}
+}
+
+void interrupt_disable(void) {
+	checkOwner();
+	assert(!disabled);
+	disabled = true;
+}
+
+void interrupt_enable(void) {
+	checkOwner();
+	assert(disabled);
+	disabled = false;
+}
+
+extern "C" int test_set_interrupt(void) {
+	checkOwner();
+	bool old = disabled;
+	disabled = true;
+	return old;
+}
+
+void assert_interrupts_private(char *file, int line, bool wanted) {
+	if(disabled != wanted) {
+		fprintf(stderr, "%s:%d: interrupts are %s\n", file, line, disabled ? "disabled" : "enabled");
+		abort();
+	}
+}
+
+void start_preemptions(bool async, bool sync, int random_seed) {
+}
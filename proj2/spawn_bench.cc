@@ -0,0 +1,68 @@
+#include <cstdlib>
+#include <iostream>
+#include <time.h>
+#include "thread.h"
+using namespace std;
+
+//Spawn benchmark: the root thread creates rounds of short-lived threads and waits for each
+//round to finish. Run with THREAD_WORKERS=n to compare worker counts.
+//Usage: spawn_bench [rounds] [threads per round]
+
+int rounds = 100; //Number of rounds
+int perRound = 1000; //Threads created in each round
+int running; //Threads of the current round that have not finished
+long work; //Total work done by all threads
+unsigned int countLock = 1; //Lock to control access to running and work
+unsigned int finished = 1; //Signals that the last thread of a round is done
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void child(void *a) {
+	long sum = 0;
+	for(long i = 0; i < (long) a; i++) {
+		sum += i;
+	}
+	thread_lock(countLock);
+	work += sum;
+	running = running - 1;
+	if(running == 0) {
+		thread_signal(countLock, finished);
+	}
+	thread_unlock(countLock);
+}
+
+void root(void *a) {
+	double begin = now();
+	for(int r = 0; r < rounds; r++) {
+		thread_lock(countLock);
+		running = perRound;
+		thread_unlock(countLock);
+		for(int i = 0; i < perRound; i++) {
+			if(thread_create((thread_startfunc_t) child, (void*) (long) (i % 64)) == -1) {
+				cout << "thread_create failed" << endl;
+				exit(1);
+			}
+		}
+		thread_lock(countLock);
+		while(running > 0) {
+			thread_wait(countLock, finished);
+		}
+		thread_unlock(countLock);
+	}
+	double elapsed = now() - begin;
+	cout << rounds * perRound << " threads in " << elapsed << " seconds, " << (long) (rounds * perRound / elapsed) << " threads/sec" << endl;
+}
+
+int main(int argc, char *argv[]) {
+	if(argc > 1) {
+		rounds = atoi(argv[1]);
+	}
+	if(argc > 2) {
+		perRound = atoi(argv[2]);
+	}
+	thread_libinit((thread_startfunc_t) root, NULL);
+}
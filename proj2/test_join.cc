@@ -0,0 +1,96 @@
+#include <cstdlib>
+#include <iostream>
+#include "thread.h"
+using namespace std;
+
+//Tests joinable threads: exit values from thread_exit and from returning,
+//joining a thread that has already finished and one that is still running,
+//the calls that must fail (joining twice, joining a detached thread, a
+//thread joining itself, an unknown handle), and many joins in a row. Run
+//with THREAD_WORKERS=n to spread the threads over n kernel threads.
+
+#define ROUNDS 200 //Batches of joinable threads
+#define BATCH 100 //Threads created and joined in each batch
+
+thread_handle_t selfHandle; //Handle of the thread that tries to join itself
+
+void check(bool ok, const char* what) {
+	if(!ok) {
+		cout << "FAILED: " << what << endl;
+		exit(1);
+	}
+}
+
+void exits(void *a) {
+	thread_exit(a);
+}
+
+void returns(void *a) {
+}
+
+void slow(void *a) {
+	for(int i = 0; i < 10; i++) {
+		thread_yield();
+	}
+	thread_exit(a);
+}
+
+void joinsSelf(void *a) {
+	thread_yield();
+	check(thread_join(selfHandle, NULL) == -1, "a thread joined itself");
+}
+
+void root(void *a) {
+	thread_handle_t handle;
+	thread_handle_t handles[BATCH];
+	void *value;
+
+	check(thread_create_joinable(exits, (void*) 42, NULL, &handle) == 0 && handle != 0, "thread_create_joinable");
+	check(thread_join(handle, &value) == 0 && (long) value == 42, "exit value from thread_exit");
+	check(thread_join(handle, &value) == -1, "joined the same thread twice");
+
+	check(thread_create_joinable(slow, (void*) 7, NULL, &handle) == 0, "thread_create_joinable");
+	thread_yield();
+	check(thread_join(handle, &value) == 0 && (long) value == 7, "exit value of a running thread");
+
+	check(thread_create_joinable(returns, NULL, NULL, &handle) == 0, "thread_create_joinable");
+	for(int i = 0; i < 3; i++) {
+		thread_yield();
+	}
+	value = (void*) 1;
+	check(thread_join(handle, &value) == 0 && value == NULL, "exit value of a thread that returned");
+
+	check(thread_create_joinable(slow, NULL, NULL, &handle) == 0, "thread_create_joinable");
+	check(thread_detach(handle) == 0, "thread_detach");
+	check(thread_detach(handle) == -1, "detached the same thread twice");
+	check(thread_join(handle, NULL) == -1, "joined a detached thread");
+
+	check(thread_create_joinable(exits, NULL, NULL, &handle) == 0, "thread_create_joinable");
+	for(int i = 0; i < 3; i++) {
+		thread_yield();
+	}
+	check(thread_detach(handle) == 0, "detaching a finished thread");
+	check(thread_join(handle, NULL) == -1, "joined a finished thread after detaching it");
+
+	check(thread_create_joinable(joinsSelf, NULL, NULL, &selfHandle) == 0, "thread_create_joinable");
+	check(thread_join(selfHandle, NULL) == 0, "joining the thread that tried to join itself");
+	check(thread_join(12345, NULL) == -1, "joined an unknown handle");
+
+	for(int round = 0; round < ROUNDS; round++) {
+		for(int i = 0; i < BATCH; i++) {
+			check(thread_create_joinable(i % 2 ? slow : exits, (void*) (long) i, NULL, &handles[i]) == 0, "thread_create_joinable");
+		}
+		for(int i = BATCH - 1; i >= 0; i--) {
+			check(thread_join(handles[i], &value) == 0 && (long) value == i, "exit value in a batch");
+		}
+	}
+	cout << "Join testcases passed!" << endl;
+	thread_exit(NULL);
+	check(false, "thread_exit returned");
+}
+
+int main() {
+	check(thread_exit(NULL) == -1, "thread_exit before thread_libinit");
+	thread_libinit(root, NULL);
+	return 1;
+}
@@ -0,0 +1,135 @@
+#include <cstdlib>
+#include <iostream>
+#include "thread.h"
+using namespace std;
+
+//Lock and condition variable stress test. Adders increment a counter under a
+//lock, yielding in the middle of the update so a broken lock loses
+//increments; a producer and a consumer pass items through a bounded buffer
+//with one condition for each side; a spawner keeps creating short-lived
+//threads on lazy stacks that take a third lock. Run with THREAD_WORKERS=n to
+//spread the threads over n kernel threads.
+
+#define ADDERS 16 //Threads incrementing the counter
+#define ADDS 2000 //Increments done by each adder
+#define ITEMS 4000 //Items passed from the producer to the consumer
+#define BUFFER_SIZE 10 //Items the buffer holds
+#define SPAWNS 200 //Short-lived threads created by the spawner
+
+#define COUNTER_LOCK 1 //Guards counter and finished
+#define DONE 1 //Signalled on COUNTER_LOCK when a thread finishes
+#define BUFFER_LOCK 2 //Guards items, produced and consumed
+#define NOT_FULL 1 //Signalled on BUFFER_LOCK when an item is taken
+#define NOT_EMPTY 2 //Signalled on BUFFER_LOCK when an item is added
+#define SPAWN_LOCK 3 //Guards spawned
+
+int counter = 0; //Incremented by the adders
+int finished = 0; //Adders, consumer and spawned threads that are done
+int items = 0; //Items in the buffer
+int produced = 0;
+int consumed = 0;
+int spawned = 0; //Spawned threads that ran
+
+void fail(const char* what) {
+	cout << "FAILED: " << what << endl;
+	exit(1);
+}
+
+void finish() {
+	thread_lock(COUNTER_LOCK);
+	finished++;
+	thread_signal(COUNTER_LOCK, DONE);
+	thread_unlock(COUNTER_LOCK);
+}
+
+void adder(void *a) {
+	for(int i = 0; i < ADDS; i++) {
+		thread_lock(COUNTER_LOCK);
+		int value = counter;
+		if(i % 7 == 0) {
+			thread_yield();
+		}
+		counter = value + 1;
+		thread_unlock(COUNTER_LOCK);
+	}
+	finish();
+}
+
+void producer(void *a) {
+	for(int i = 0; i < ITEMS; i++) {
+		thread_lock(BUFFER_LOCK);
+		while(items == BUFFER_SIZE) {
+			thread_wait(BUFFER_LOCK, NOT_FULL);
+		}
+		items++;
+		produced++;
+		thread_signal(BUFFER_LOCK, NOT_EMPTY);
+		thread_unlock(BUFFER_LOCK);
+	}
+}
+
+void consumer(void *a) {
+	for(int i = 0; i < ITEMS; i++) {
+		thread_lock(BUFFER_LOCK);
+		while(items == 0) {
+			thread_wait(BUFFER_LOCK, NOT_EMPTY);
+		}
+		if(items > BUFFER_SIZE) {
+			fail("buffer overfilled");
+		}
+		items--;
+		consumed++;
+		thread_broadcast(BUFFER_LOCK, NOT_FULL);
+		thread_unlock(BUFFER_LOCK);
+	}
+	finish();
+}
+
+void spawnee(void *a) {
+	thread_lock(SPAWN_LOCK);
+	spawned++;
+	thread_unlock(SPAWN_LOCK);
+	finish();
+}
+
+void spawner(void *a) {
+	thread_attr_t attr = {};
+	attr.lazy_stack = true;
+	for(int i = 0; i < SPAWNS; i++) {
+		if(thread_create_attr(spawnee, NULL, &attr) != 0) {
+			fail("thread_create_attr");
+		}
+	}
+}
+
+void root(void *a) {
+	for(int i = 0; i < ADDERS; i++) {
+		thread_create(adder, NULL);
+	}
+	thread_create(producer, NULL);
+	thread_create(consumer, NULL);
+	thread_create(spawner, NULL);
+	thread_lock(COUNTER_LOCK);
+	while(finished < ADDERS + 1 + SPAWNS) {
+		thread_wait(COUNTER_LOCK, DONE);
+	}
+	thread_unlock(COUNTER_LOCK);
+	if(counter != ADDERS * ADDS) {
+		fail("lost increments");
+	}
+	if(produced != ITEMS || consumed != ITEMS || items != 0) {
+		fail("items lost in the buffer");
+	}
+	if(spawned != SPAWNS) {
+		fail("spawned threads missing");
+	}
+	if(thread_unlock(COUNTER_LOCK) != -1) {
+		fail("unlocking a lock that is not held");
+	}
+	cout << "Lock testcases passed!" << endl;
+}
+
+int main() {
+	thread_libinit(root, NULL);
+	return 1;
+}
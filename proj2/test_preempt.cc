@@ -0,0 +1,79 @@
+#include <cstdlib>
+#include <iostream>
+#include <time.h>
+#include "thread.h"
+using namespace std;
+
+//Tests preemption with more than one worker. Many more threads than workers
+//spin without calling into the library until all of them have started, which
+//only happens if running threads are preempted; then they all add to a
+//counter under a lock, so time slices also end while the lock is held and
+//inside library calls. With one worker preemption comes from the interrupt
+//layer, which the stand-in in interrupt_stub.cc does not provide, so the test
+//is skipped.
+
+#define SPINNERS 32 //Threads that spin
+#define ADDS 20000 //Increments done by each spinner
+#define TIMEOUT 10 //Seconds a spinner waits for the others to start
+
+#define COUNTER_LOCK 1 //Guards counter and finished
+#define DONE 1 //Signalled on COUNTER_LOCK when a spinner finishes
+
+volatile int started = 0; //Spinners that have started
+int counter = 0;
+int finished = 0;
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void fail(const char* what) {
+	cout << "FAILED: " << what << endl;
+	exit(1);
+}
+
+void spinner(void *a) {
+	__atomic_add_fetch(&started, 1, __ATOMIC_SEQ_CST);
+	double start = now();
+	while(__atomic_load_n(&started, __ATOMIC_SEQ_CST) < SPINNERS) {
+		if(now() - start > TIMEOUT) {
+			fail("spinning threads were not preempted");
+		}
+	}
+	for(int i = 0; i < ADDS; i++) {
+		thread_lock(COUNTER_LOCK);
+		counter++;
+		thread_unlock(COUNTER_LOCK);
+	}
+	thread_lock(COUNTER_LOCK);
+	finished++;
+	thread_signal(COUNTER_LOCK, DONE);
+	thread_unlock(COUNTER_LOCK);
+}
+
+void root(void *a) {
+	for(int i = 0; i < SPINNERS; i++) {
+		thread_create(spinner, NULL);
+	}
+	thread_lock(COUNTER_LOCK);
+	while(finished < SPINNERS) {
+		thread_wait(COUNTER_LOCK, DONE);
+	}
+	thread_unlock(COUNTER_LOCK);
+	if(counter != SPINNERS * ADDS) {
+		fail("lost increments");
+	}
+	cout << "Preemption testcases passed!" << endl;
+}
+
+int main() {
+	const char* workers = getenv("THREAD_WORKERS");
+	if(workers == NULL || atoi(workers) <= 1) {
+		cout << "Preemption testcases skipped with one worker" << endl;
+		return 0;
+	}
+	thread_libinit(root, NULL);
+	return 1;
+}
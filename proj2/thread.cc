@@ -1,8 +1,17 @@
 #include <cstdlib>
+#include <cstring>
 #include <ucontext.h>
 #include <iostream>
-#include <deque>
-#include <map>
+#include <new>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
 #include "thread.h"
 #include "interrupt.h"
 using namespace std;
@@ -10,409 +19,1212 @@ using namespace std;
 struct condition_t {
 	unsigned int associatedLock;
 	unsigned int conditionVar;
-	//Need to add this comparator so that condition_t can be used in a map
-	bool operator<(const condition_t& o) const {
-		if(associatedLock == o.associatedLock) {
-			return conditionVar < o.conditionVar;
-		}
-		else {
-			return associatedLock < o.associatedLock;
-		}
+	bool operator==(const condition_t& o) const {
+		return associatedLock == o.associatedLock && conditionVar == o.conditionVar;
 	}
 };
 
-deque<ucontext_t*> readyQueue; //Queue of threads approved to run
-ucontext_t* current; //Current running thread
-map<unsigned int, ucontext_t*> lockHolder; //Maps locks to the thread that holds the lock
-map<unsigned int, deque<ucontext_t*> > lockMap; //Maps locks to a lock queue
-map<condition_t, deque<ucontext_t*> > conditionMap; //Maps condition variables to a wait queue
+//Contexts. On x86-64 a switch is a few instructions that save the
+//callee-saved registers on the stack being left, swap stack pointers and pop
+//the registers of the context being resumed. Unlike swapcontext it makes no
+//system call: the signal mask is left to the interrupt layer, which is
+//disabled on both sides of every switch. Build with -DTHREAD_UCONTEXT, or on
+//other targets, to use swapcontext instead.
+#if defined(__x86_64__) && !defined(THREAD_UCONTEXT)
+struct context_t {
+	void* sp; //Saved registers are on the stack at sp
+};
+
+typedef void* (*entry_t)(thread_startfunc_t, void*);
+
+extern "C" void switchStacks(void** save, void* sp);
+extern "C" void jumpStack(void* sp);
+extern "C" void contextEntry();
+
+//Stack of a suspended context, from sp up: x87 control word, MXCSR, r15, r14,
+//r13, r12, rbx, rbp, return address
+asm(
+	".text\n"
+	".globl switchStacks\n"
+	".type switchStacks, @function\n"
+	"switchStacks:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $16, %rsp\n"
+	"	stmxcsr 8(%rsp)\n"
+	"	fnstcw (%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rdi\n"
+	".globl jumpStack\n"
+	".type jumpStack, @function\n"
+	"jumpStack:\n"
+	"	movq %rdi, %rsp\n"
+	"	fldcw (%rsp)\n"
+	"	ldmxcsr 8(%rsp)\n"
+	"	addq $16, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	//First return into a new context lands here with entry(func, arg) in r12, r13, r14
+	".globl contextEntry\n"
+	".type contextEntry, @function\n"
+	"contextEntry:\n"
+	"	movq %r13, %rdi\n"
+	"	movq %r14, %rsi\n"
+	"	callq *%r12\n"
+	"	ud2\n"
+);
+
+void contextInit(context_t* context) {
+}
+
+//Sets up a context to run entry(func, arg) on the given stack
+void contextMake(context_t* context, char* stack, size_t size, entry_t entry, thread_startfunc_t func, void* arg) {
+	//contextEntry is entered by ret, so the slot above the return address must be 16-byte aligned for its call
+	void** sp = (void**) (((size_t) stack + size) & ~(size_t) 15) - 1;
+	*sp = (void*) contextEntry;
+	sp -= 8;
+	sp[0] = (void*) 0x37f; //Default x87 control word
+	sp[1] = (void*) 0x1f80; //Default MXCSR
+	sp[2] = NULL; //r15
+	sp[3] = (void*) arg; //r14
+	sp[4] = (void*) func; //r13
+	sp[5] = (void*) entry; //r12
+	sp[6] = NULL; //rbx
+	sp[7] = NULL; //rbp
+	context->sp = sp;
+}
+
+//Saves the running context in from and resumes to
+void contextSwitch(context_t* from, context_t* to) {
+	switchStacks(&from->sp, to->sp);
+}
+
+//Resumes to, abandoning the running context
+void contextJump(context_t* to) {
+	jumpStack(to->sp);
+}
+#else
+typedef ucontext_t context_t;
+
+typedef void* (*entry_t)(thread_startfunc_t, void*);
+
+void contextInit(context_t* context) {
+	getcontext(context);
+}
+
+void contextMake(context_t* context, char* stack, size_t size, entry_t entry, thread_startfunc_t func, void* arg) {
+	context->uc_stack.ss_sp = stack;
+	context->uc_stack.ss_size = size;
+	context->uc_stack.ss_flags = 0;
+	context->uc_link = NULL;
+	makecontext(context, (void (*)()) entry, 2, func, arg);
+}
+
+void contextSwitch(context_t* from, context_t* to) {
+	swapcontext(from, to);
+}
+
+void contextJump(context_t* to) {
+	setcontext(to);
+}
+#endif
+
+//Lock and condition tables: open addressing with linear probing on the ids,
+//so finding a lock is one hash and usually one probe. A lock has an entry only
+//while it is held and a condition only while some thread waits on it. Waiting
+//threads are queued through the links in their thread_t, so queueing, handing
+//a lock over and signalling never allocate.
+//
+//A thread_t and its stack stay together for life. When the thread finishes
+//both go to the pool of the worker it finished on, or to a shared pool once
+//that one is full, and thread_create takes from those pools before it maps a
+//new stack, so creating threads in a loop neither allocates nor touches fresh
+//stack pages. Only default stacks are pooled; a thread with another stack size
+//or a lazy stack gives its mapping back as soon as it finishes.
+struct thread_t {
+	context_t context;
+	char* stack; //Mapping of the stack, starting with its guard page
+	size_t stackSize; //Not counting the guard page
+	bool lazy; //Stack mapped without reserving memory for it
+	int priority; //Index of the run queues the thread goes on
+	char name[16];
+	thread_handle_t id; //Key of the thread's join_t, 0 if it was created detached
+	thread_t* next; //Links in a lock or condition queue, or in a pool
+	thread_t* prev;
+};
+
+struct waitQueue_t {
+	thread_t* head; //Next to wake
+	thread_t* tail;
+};
+
+struct lock_t {
+	unsigned int key;
+	bool used;
+	thread_t* holder;
+	waitQueue_t waiters;
+};
+
+struct cond_t {
+	condition_t key;
+	bool used;
+	waitQueue_t waiters;
+};
+
+//Exit status of a joinable thread, kept from thread_create_joinable until the
+//thread is joined, or finishes after being detached. The thread_t is recycled
+//as soon as the thread finishes; only this entry outlives it.
+struct join_t {
+	thread_handle_t key;
+	bool used;
+	bool finished;
+	bool detached;
+	void* value; //Exit value once finished
+	thread_t* joiner; //Thread blocked in thread_join
+};
+
+template <class entry_t> struct table_t {
+	entry_t* slots;
+	unsigned int mask; //Number of slots, a power of two, minus one
+	unsigned int count;
+};
+
+#define TABLE_SIZE 64 //Initial number of slots in each table
+
+//M:N scheduling: user threads run on numWorkers kernel threads (workers), set
+//with the THREAD_WORKERS environment variable and 1 by default. Each worker
+//owns a run queue (see runQueue_t); threads it creates or wakes go on its own
+//queue, and a worker whose queue is empty steals from randomly chosen others
+//before it parks in its idle context. runnable counts threads that are ready
+//or running; when it drops to zero every thread is blocked or finished and
+//the library exits.
+//
+//The interrupt layer simulates a single interrupt mask for the whole process,
+//which asserts it is never disabled twice, so with more than one worker the
+//library does not use it: thread_libinit disables interrupts once and leaves
+//them disabled, and blocks SIGALRM, which every worker inherits, so the
+//interrupt layer never runs at all. Instead each worker has its own mask
+//(worker_t::masked) and a timer on its own CPU time that sends it
+//PREEMPT_SIGNAL every TIME_SLICE_NS; see preempt. start_preemptions has no
+//effect in that mode.
+//
+//The lock and condition tables are protected by the guard spinlock in either
+//mode. A thread never becomes visible to other workers before its context is
+//saved: a thread that blocks holds the guard across the switch, and a thread
+//that yields is only put on a run queue once the switch is done. Both are
+//left to the context that resumes (finishSwitch).
+
+//Chase-Lev work-stealing deque of ready threads, a circular array that grows
+//as needed. Only the owning worker pushes, at the bottom; threads are taken
+//from the top with a compare-and-swap, by thieves and by the owner alike, so
+//each worker still runs its own threads in FIFO order and thread_yield lets
+//every other ready thread run first. Arrays outgrown while a thief may still
+//be reading them are kept on a retired list rather than freed.
+struct runArray_t {
+	long size; //Power of two
+	runArray_t* retired; //Older, smaller array
+	thread_t** slots;
+};
+
+struct runQueue_t {
+	volatile long top;
+	char pad[64]; //Keep top and bottom on separate cache lines
+	volatile long bottom;
+	runArray_t* array;
+};
+
+#define PRIORITIES 2 //Normal and high priority
+
+struct worker_t {
+	thread_t* current; //User thread running on this worker, NULL while idle
+	context_t idle; //Context of the worker's idle loop
+	runQueue_t queues[PRIORITIES]; //One run queue per priority
+	thread_t* pending; //Yielding thread to queue once the switch is done
+	thread_t* finished; //Finished thread to recycle once the switch is done
+	bool passGuard; //The guard was held across the last switch
+	volatile bool masked; //In library code or idle, so not to be preempted (more than one worker only)
+	thread_t* pool; //Finished threads kept for reuse, with their stacks
+	int poolSize;
+	unsigned int seed; //For picking victims
+	pthread_t pthread;
+};
+
+#define RUN_QUEUE_SIZE 64 //Initial capacity of each run queue
+#define STEAL_ATTEMPTS 4 //Rounds of random victims tried before idling
+#define POOL_SIZE 1024 //Threads each worker keeps for reuse, and the shared pool per worker
+#define PREEMPT_SIGNAL SIGURG //Time slice signal with more than one worker; ignored by default, so stray ones are harmless
+#define TIME_SLICE_NS 10000000 //CPU time a thread runs before it is preempted with more than one worker, as with start_preemptions
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid //Older C libraries only have the kernel's name
+#endif
+
+worker_t* workers; //All workers; workers[0] is the thread that called thread_libinit
+int numWorkers = 1; //Number of workers
+volatile int runnable = 0; //Threads that are ready or running
+volatile int idleWorkers = 0; //Workers asleep in their idle loop that nobody has woken yet
+sem_t idleSem; //Posted once for each idle worker woken up
+volatile int guard = 0; //Lock for the lock and condition tables
+__thread worker_t* self; //Worker running on this kernel thread
+table_t<lock_t> locks; //Held locks, with the holder and the lock queue
+table_t<cond_t> conditions; //Condition variables, with the wait queue
+table_t<join_t> joins; //Joinable threads, by handle
+thread_handle_t lastId = 0; //Last handle given out
 bool initialized = false; //Stores whether or not thread_libinit has been called
-deque<ucontext_t*> toDelete; //Hacky way to delete threads after they finish
+long pageSize; //Size of the guard page below each stack
+thread_t* sharedPool; //Finished threads that did not fit in their worker's pool, under the guard
+int sharedPoolSize;
 
 //For debugging purposes
 int printQueues() {
 //	cout << "Current thread: " << current << endl;
-	for(map<unsigned int, ucontext_t*>::iterator it=lockHolder.begin(); it!=lockHolder.end(); ++it) {
-		cout << "Lock " << it->first << "->" << it->second << endl;
+	for(unsigned int i = 0; i <= locks.mask; i++) {
+		if(locks.slots[i].used) {
+			cout << "Lock " << locks.slots[i].key << "->" << locks.slots[i].holder << endl;
+		}
 	}
-	cout << "Ready queue: ";
-	for(deque<ucontext_t*>::iterator it=readyQueue.begin(); it!=readyQueue.end(); ++it) {
-		cout << *it << " -> ";
+	for(int i = 0; i < numWorkers; i++) {
+		for(int p = PRIORITIES - 1; p >= 0; p--) {
+			runQueue_t* queue = &workers[i].queues[p];
+			cout << "Run queue " << i << " priority " << p << ": ";
+			for(long j = queue->top; j < queue->bottom; j++) {
+				thread_t* thread = queue->array->slots[j & (queue->array->size - 1)];
+				cout << thread << " " << thread->name << " -> ";
+			}
+			cout << "end" << endl;
+		}
 	}
-	cout << "end" << endl;
 	return 0;
 }
 
+//Returns the worker the caller is running on. A user thread can resume on a
+//different kernel thread after any switch, so this must not be inlined into
+//callers where the compiler could reuse a thread-local address from before it.
+__attribute__((noinline)) worker_t* thisWorker() {
+	return self;
+}
+
 void printCurrent(int t) {
-	cout << t << " printing current context: " << current << endl;
-}
-
-//Switches to the next context in the ready queue and saves current context
-void switchNext() {
-	ucontext_t* currentContext = current;
-	if (readyQueue.empty()){
-		if(!toDelete.empty()) {
-			ucontext_t* deleting = toDelete.back();
-			toDelete.pop_back();
-			delete [] (char*) deleting->uc_stack.ss_sp;
-			delete deleting;
-//			cout << "DELETE" << endl;
+	thread_t* current = thisWorker()->current;
+	cout << t << " printing current context: " << current << " " << (current != NULL ? current->name : "") << endl;
+}
+
+void lockGuard() {
+	while(__sync_lock_test_and_set(&guard, 1)) {
+		while(guard) {
+			sched_yield();
+		}
+	}
+}
+
+void unlockGuard() {
+	__sync_lock_release(&guard);
+}
+
+//Mask and unmask preemption around the library's own code: the interrupt
+//layer with one worker, the worker's own mask with more. A time slice that
+//ends after a thread reads its worker but before it masks it may move the
+//thread to another worker; it then masks the old worker too, which only
+//costs whatever runs there its current time slice, and tries again.
+void disableInterrupts() {
+	if(numWorkers == 1) {
+		interrupt_disable();
+		return;
+	}
+	worker_t* worker;
+	do {
+		worker = thisWorker();
+		worker->masked = true;
+	} while(worker != thisWorker());
+}
+
+void enableInterrupts() {
+	if(numWorkers == 1) {
+		interrupt_enable();
+		return;
+	}
+	thisWorker()->masked = false;
+}
+
+//Enters and leaves the library's critical sections
+void enter() {
+	disableInterrupts();
+	lockGuard();
+}
+
+void leave() {
+	unlockGuard();
+	enableInterrupts();
+}
+
+unsigned int hashKey(unsigned int key) {
+	unsigned int hash = key * 2654435769u;
+	return hash ^ (hash >> 16);
+}
+
+unsigned int hashKey(const condition_t& key) {
+	unsigned int hash = key.associatedLock * 2654435769u ^ key.conditionVar * 2246822519u;
+	return hash ^ (hash >> 16);
+}
+
+template <class entry_t> void tableInit(table_t<entry_t>* table) {
+	table->slots = new entry_t[TABLE_SIZE]();
+	table->mask = TABLE_SIZE - 1;
+	table->count = 0;
+}
+
+template <class entry_t, class key_t> entry_t* tableFind(table_t<entry_t>* table, const key_t& key) {
+	for(unsigned int i = hashKey(key) & table->mask; table->slots[i].used; i = (i + 1) & table->mask) {
+		if(table->slots[i].key == key) {
+			return &table->slots[i];
+		}
+	}
+	return NULL;
+}
+
+//Adds an entry for a key that is not in the table, keeping it at most half
+//full. Returns NULL if the table had to grow and there was no memory.
+template <class entry_t, class key_t> entry_t* tableInsert(table_t<entry_t>* table, const key_t& key) {
+	if(2 * (table->count + 1) > table->mask + 1) {
+		unsigned int size = 2 * (table->mask + 1);
+		entry_t* slots = new (nothrow) entry_t[size]();
+		if(slots == NULL) {
+			return NULL;
+		}
+		for(unsigned int i = 0; i <= table->mask; i++) {
+			if(table->slots[i].used) {
+				unsigned int j = hashKey(table->slots[i].key) & (size - 1);
+				while(slots[j].used) {
+					j = (j + 1) & (size - 1);
+				}
+				slots[j] = table->slots[i];
+			}
+		}
+		delete [] table->slots;
+		table->slots = slots;
+		table->mask = size - 1;
+	}
+	unsigned int i = hashKey(key) & table->mask;
+	while(table->slots[i].used) {
+		i = (i + 1) & table->mask;
+	}
+	table->slots[i] = entry_t();
+	table->slots[i].key = key;
+	table->slots[i].used = true;
+	table->count++;
+	return &table->slots[i];
+}
+
+//Removes an entry, shifting later entries of its probe run back into the hole
+//so lookups never need tombstones
+template <class entry_t> void tableRemove(table_t<entry_t>* table, entry_t* entry) {
+	unsigned int hole = entry - table->slots;
+	table->slots[hole].used = false;
+	table->count--;
+	for(unsigned int i = (hole + 1) & table->mask; table->slots[i].used; i = (i + 1) & table->mask) {
+		//An entry may move back to the hole unless its home slot lies after the hole
+		unsigned int home = hashKey(table->slots[i].key) & table->mask;
+		if(((i - home) & table->mask) >= ((i - hole) & table->mask)) {
+			table->slots[hole] = table->slots[i];
+			table->slots[i].used = false;
+			hole = i;
+		}
+	}
+}
+
+void waitQueuePush(waitQueue_t* queue, thread_t* thread) {
+	thread->next = NULL;
+	thread->prev = queue->tail;
+	if(queue->tail == NULL) {
+		queue->head = thread;
+	}
+	else {
+		queue->tail->next = thread;
+	}
+	queue->tail = thread;
+}
+
+//Returns the thread waiting longest, or NULL if there is none
+thread_t* waitQueuePop(waitQueue_t* queue) {
+	thread_t* thread = queue->head;
+	if(thread == NULL) {
+		return NULL;
+	}
+	queue->head = thread->next;
+	if(queue->head == NULL) {
+		queue->tail = NULL;
+	}
+	else {
+		queue->head->prev = NULL;
+	}
+	return thread;
+}
+
+//Returns a thread with a stack of the given size, a multiple of the page
+//size, or NULL if there is no memory for it. Default stacks come from the
+//worker's pool or the shared one when they have any.
+thread_t* threadAlloc(worker_t* worker, size_t stackSize, bool lazy) {
+	thread_t* thread = NULL;
+	if(stackSize == STACK_SIZE && !lazy) {
+		thread = worker->pool;
+		if(thread != NULL) {
+			worker->pool = thread->next;
+			worker->poolSize--;
+			return thread;
+		}
+		lockGuard();
+		thread = sharedPool;
+		if(thread != NULL) {
+			sharedPool = thread->next;
+			sharedPoolSize--;
+		}
+		unlockGuard();
+		if(thread != NULL) {
+			return thread;
+		}
+	}
+	thread = new (nothrow) thread_t;
+	if(thread == NULL) {
+		return NULL;
+	}
+	//A lazy stack only reserves address space; pages are committed when first touched
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK | (lazy ? MAP_NORESERVE : 0);
+	//The lowest page stays inaccessible, so overflowing the stack faults instead of overwriting memory below it
+	thread->stack = (char*) mmap(NULL, pageSize + stackSize, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if(thread->stack == MAP_FAILED || mprotect(thread->stack, pageSize, PROT_NONE) != 0) {
+		if(thread->stack != MAP_FAILED) {
+			munmap(thread->stack, pageSize + stackSize);
+		}
+		delete thread;
+		return NULL;
+	}
+	thread->stackSize = stackSize;
+	thread->lazy = lazy;
+	contextInit(&thread->context);
+	return thread;
+}
+
+//Recycles a finished thread that is no longer running on its stack. Called
+//without the guard.
+void threadFree(worker_t* worker, thread_t* thread) {
+	if(thread->stackSize != STACK_SIZE || thread->lazy) {
+		munmap(thread->stack, pageSize + thread->stackSize);
+		delete thread;
+		return;
+	}
+	if(worker->poolSize < POOL_SIZE) {
+		thread->next = worker->pool;
+		worker->pool = thread;
+		worker->poolSize++;
+		return;
+	}
+	//Threads created on one worker and finished on another would otherwise pile up on the second
+	lockGuard();
+	if(sharedPoolSize < POOL_SIZE * numWorkers) {
+		thread->next = sharedPool;
+		sharedPool = thread;
+		sharedPoolSize++;
+		thread = NULL;
+	}
+	unlockGuard();
+	if(thread == NULL) {
+		return;
+	}
+	munmap(thread->stack, pageSize + thread->stackSize);
+	delete thread;
+}
+
+void runQueueInit(runQueue_t* queue) {
+	queue->top = queue->bottom = 0;
+	queue->array = new runArray_t;
+	queue->array->size = RUN_QUEUE_SIZE;
+	queue->array->retired = NULL;
+	queue->array->slots = new thread_t*[RUN_QUEUE_SIZE];
+}
+
+//Called by the owner only
+void runQueuePush(runQueue_t* queue, thread_t* thread) {
+	long bottom = queue->bottom;
+	long top = __atomic_load_n(&queue->top, __ATOMIC_ACQUIRE);
+	runArray_t* array = queue->array;
+	if(bottom - top >= array->size) {
+		runArray_t* bigger = new runArray_t;
+		bigger->size = 2 * array->size;
+		bigger->retired = array;
+		bigger->slots = new thread_t*[bigger->size];
+		for(long i = top; i < bottom; i++) {
+			bigger->slots[i & (bigger->size - 1)] = array->slots[i & (array->size - 1)];
+		}
+		__atomic_store_n(&queue->array, bigger, __ATOMIC_RELEASE);
+		array = bigger;
+	}
+	array->slots[bottom & (array->size - 1)] = thread;
+	__atomic_store_n(&queue->bottom, bottom + 1, __ATOMIC_RELEASE);
+}
+
+//Takes the oldest thread, or returns NULL if the queue is empty or another
+//worker won the race for it
+thread_t* runQueueTake(runQueue_t* queue) {
+	//Cheap early out for an empty queue; a thread queued meanwhile also wakes an idle worker
+	if(__atomic_load_n(&queue->top, __ATOMIC_RELAXED) >= __atomic_load_n(&queue->bottom, __ATOMIC_RELAXED)) {
+		return NULL;
+	}
+	long top = __atomic_load_n(&queue->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long bottom = __atomic_load_n(&queue->bottom, __ATOMIC_ACQUIRE);
+	if(top >= bottom) {
+		return NULL;
+	}
+	runArray_t* array = __atomic_load_n(&queue->array, __ATOMIC_ACQUIRE);
+	thread_t* thread = array->slots[top & (array->size - 1)];
+	if(!__atomic_compare_exchange_n(&queue->top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		return NULL;
+	}
+	return thread;
+}
+
+//Takes the highest priority thread from one of a worker's queues
+thread_t* takeFrom(worker_t* worker) {
+	thread_t* thread = NULL;
+	for(int p = PRIORITIES - 1; thread == NULL && p >= 0; p--) {
+		thread = runQueueTake(&worker->queues[p]);
+	}
+	return thread;
+}
+
+//Takes one from the worker's own queues, else steals from random victims
+thread_t* findWork(worker_t* worker) {
+	thread_t* thread = takeFrom(worker);
+	for(int i = 0; thread == NULL && i < STEAL_ATTEMPTS * (numWorkers - 1); i++) {
+		worker_t* victim = &workers[rand_r(&worker->seed) % numWorkers];
+		if(victim != worker) {
+			thread = takeFrom(victim);
+		}
+	}
+	return thread;
+}
+
+//Wakes an idle worker, if any, after something was queued
+void wakeIdle() {
+	int idle = __atomic_load_n(&idleWorkers, __ATOMIC_SEQ_CST);
+	while(idle > 0) {
+		if(__atomic_compare_exchange_n(&idleWorkers, &idle, idle - 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+			sem_post(&idleSem);
+			return;
 		}
+	}
+}
+
+//Queues a thread that was not runnable (new, or woken up) on this worker
+void makeReady(thread_t* thread) {
+	__atomic_add_fetch(&runnable, 1, __ATOMIC_SEQ_CST);
+	runQueuePush(&thisWorker()->queues[thread->priority], thread);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	wakeIdle();
+}
+
+//Marks the current thread as blocked or finished; exits the library if that
+//leaves no thread that could ever run again
+void stopRunning() {
+	if(__atomic_sub_fetch(&runnable, 1, __ATOMIC_SEQ_CST) == 0) {
 		cout << "Thread library exiting." << endl;
 		exit(0);
 	}
-	ucontext_t* nextContext = readyQueue.back();
-	readyQueue.pop_back();
-	current = nextContext;
-//	cout << "Current thread: " << current << endl;
-	swapcontext(currentContext, nextContext);
+}
+
+//Completes a switch on behalf of the context that switched away; run first
+//thing by every context that resumes
+void finishSwitch() {
+	worker_t* worker = thisWorker();
+	if(worker->pending != NULL) {
+		runQueuePush(&worker->queues[worker->pending->priority], worker->pending);
+		worker->pending = NULL;
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		wakeIdle();
+	}
+	if(worker->passGuard) {
+		worker->passGuard = false;
+		unlockGuard();
+	}
+	if(worker->finished != NULL) {
+		threadFree(worker, worker->finished);
+		worker->finished = NULL;
+	}
+}
+
+//Switches from the current thread to next, or to the worker's idle loop if
+//next is NULL. Returns once the current thread is resumed, on whatever worker.
+void switchTo(thread_t* next) {
+	worker_t* worker = thisWorker();
+	thread_t* currentThread = worker->current;
+	worker->current = next;
+	contextSwitch(&currentThread->context, next != NULL ? &next->context : &worker->idle);
+	finishSwitch();
+}
+
+//Blocks the current thread, which the caller has already put on a lock or
+//condition queue, and runs something else. Called and returns with the
+//guard held.
+void block() {
+	stopRunning();
+	thisWorker()->passGuard = true;
+	switchTo(findWork(thisWorker()));
+	lockGuard();
+}
+
+//Sleeps until wakeIdle posts idleSem; a time slice signal that was already
+//on its way does not count as a wakeup
+void waitIdle() {
+	while(sem_wait(&idleSem) != 0) {
+	}
+}
+
+//A worker's idle loop, run on the worker's own kernel stack. Interrupts stay
+//disabled here since there is no thread to preempt. A worker about to sleep
+//counts itself idle before looking for work one last time, so a thread
+//queued meanwhile either is found or wakes it.
+void idleLoop(worker_t* worker) {
+	while(true) {
+		thread_t* thread = findWork(worker);
+		if(thread == NULL) {
+			__atomic_add_fetch(&idleWorkers, 1, __ATOMIC_SEQ_CST);
+			thread = findWork(worker);
+			if(thread != NULL) {
+				//Take back the idle count, or the wakeup someone already sent for it
+				int idle = __atomic_load_n(&idleWorkers, __ATOMIC_SEQ_CST);
+				bool claimed = false;
+				while(idle > 0 && !claimed) {
+					claimed = __atomic_compare_exchange_n(&idleWorkers, &idle, idle - 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+				}
+				if(!claimed) {
+					waitIdle();
+				}
+			}
+			else {
+				waitIdle();
+				continue;
+			}
+		}
+		worker->current = thread;
+		contextSwitch(&worker->idle, &thread->context);
+		finishSwitch();
+	}
+}
+
+//Starts the calling worker's time slice timer. It counts the worker's CPU
+//time, so a worker asleep in its idle loop gets no ticks.
+void startTimeSlices() {
+	struct sigevent event;
+	memset(&event, 0, sizeof(event));
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = PREEMPT_SIGNAL;
+	event.sigev_notify_thread_id = syscall(SYS_gettid);
+	timer_t timer;
+	struct itimerspec slice;
+	slice.it_value.tv_sec = 0;
+	slice.it_value.tv_nsec = TIME_SLICE_NS;
+	slice.it_interval = slice.it_value;
+	if(timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) == 0) {
+		timer_settime(timer, 0, &slice, NULL);
+	}
+}
+
+//Switches to another ready thread, if any; the current one goes back on the
+//run queue once it is saved. Called with interrupts disabled.
+void yieldCurrent() {
+	worker_t* worker = thisWorker();
+	thread_t* next = findWork(worker);
+	if(next != NULL) {
+		worker->pending = worker->current;
+		switchTo(next);
+	}
+}
+
+//PREEMPT_SIGNAL handler. Unless its worker is masked, the thread it
+//interrupted yields as if it had called thread_yield. The thread may resume,
+//and return from the handler, on another worker; every worker has the same
+//signal mask, so the one restored on return is right there as well.
+void preempt(int sig) {
+	worker_t* worker = self;
+	if(worker == NULL || worker->masked) {
+		return;
+	}
+	int savedErrno = errno;
+	worker->masked = true;
+	//Let this worker take the next tick while the thread is switched out
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, PREEMPT_SIGNAL);
+	pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+	yieldCurrent();
+	enableInterrupts();
+	errno = savedErrno;
+}
+
+void *workerMain(void *arg) {
+	self = (worker_t*) arg;
+	startTimeSlices();
+	idleLoop(self);
+	return NULL;
+}
+
+//Ends the current thread with the given exit value. Called with interrupts
+//disabled; never returns.
+void finishThread(void* value) {
+	worker_t* worker = thisWorker();
+	thread_t* thread = worker->current;
+	if(thread->id != 0) {
+		lockGuard();
+		join_t* entry = tableFind(&joins, thread->id);
+		if(entry->detached) {
+			tableRemove(&joins, entry);
+		}
+		else {
+			entry->finished = true;
+			entry->value = value;
+			if(entry->joiner != NULL) {
+				makeReady(entry->joiner);
+			}
+		}
+		unlockGuard();
+	}
+	stopRunning();
+
+	//Run next thread, or go idle; whichever it is recycles this thread once we are off its stack
+	worker->finished = worker->current;
+	worker->current = findWork(worker);
+	contextJump(worker->current != NULL ? &worker->current->context : &worker->idle);
 }
 
 //Stub helper function to start new threads
 void *start(thread_startfunc_t func, void *arg) {
 	//Run function
-	interrupt_enable();
+	finishSwitch();
+	enableInterrupts();
 //	cout << "func start: " << arg << endl;
 	func(arg);
 //	cout << "func finished in start" << endl;
-	interrupt_disable();
-
-	//FREE THE THREAD'S STACK AND THEN FREE THE THREAD
-	//If function returns, run next thread
-	if(readyQueue.empty()) {
-
-		if(!toDelete.empty()) {
-			ucontext_t* deleting = toDelete.back();
-			toDelete.pop_back();
-			delete [] (char*) deleting->uc_stack.ss_sp;
-			delete deleting;
-//			cout << "DELETE" << endl;
-		}
-		cout << "Thread library exiting.\n";
-		exit(0);
-	} 
-	else {
-		if(!toDelete.empty()) {
-			ucontext_t* deleting = toDelete.back();
-			toDelete.pop_back();
-			delete [] (char*) deleting->uc_stack.ss_sp;
-			delete deleting;
-//			cout << "DELETE" << endl;
-		}
-		toDelete.push_front(current);
-		
-		ucontext_t* nextContext = readyQueue.back();
-		readyQueue.pop_back();
-		//ucontext_t* currentContext = new ucontext_t();
-		current = nextContext;
-		setcontext(nextContext);
-	}
+	disableInterrupts();
+	finishThread(NULL);
+	return NULL;
 }
 
 int thread_libinit(thread_startfunc_t func, void *arg) {
-	interrupt_disable();
+	disableInterrupts();
 	//If thread_libinit has already been called, return error
 	if(initialized) {
-		interrupt_enable();
+		enableInterrupts();
 		return -1;
 	}
 	initialized = true;
+	//numWorkers stays 1 until the other workers start, so failing below still enables interrupts
+	int wantedWorkers = 1;
+	const char* env = getenv("THREAD_WORKERS");
+	if(env != NULL && atoi(env) > 1) {
+		wantedWorkers = atoi(env);
+	}
 	try {
+		tableInit(&locks);
+		tableInit(&conditions);
+		tableInit(&joins);
+		workers = new worker_t[wantedWorkers];
+		for(int i = 0; i < wantedWorkers; i++) {
+			workers[i].current = NULL;
+			for(int p = 0; p < PRIORITIES; p++) {
+				runQueueInit(&workers[i].queues[p]);
+			}
+			workers[i].pending = NULL;
+			workers[i].finished = NULL;
+			workers[i].passGuard = false;
+			workers[i].masked = true;
+			workers[i].pool = NULL;
+			workers[i].poolSize = 0;
+			workers[i].seed = i + 1;
+		}
+		sem_init(&idleSem, 0, 0);
+		pageSize = sysconf(_SC_PAGESIZE);
+		self = &workers[0];
+		self->pthread = pthread_self();
 		//Create context of initial thread and push it onto the ready queue
-		ucontext_t* initial_thread = new ucontext_t();
-		getcontext(initial_thread);
-		char *stack = new char[STACK_SIZE];
+		thread_t* initial_thread = threadAlloc(self, STACK_SIZE, false);
+		if(initial_thread == NULL) {
+			enableInterrupts();
+			return -1;
+		}
 	//	cout << "FIRST" << endl;
-		initial_thread->uc_stack.ss_sp = stack;
-		initial_thread->uc_stack.ss_size = STACK_SIZE;
-		initial_thread->uc_stack.ss_flags = 0;
-		initial_thread->uc_link = NULL;
-		makecontext(initial_thread, (void (*)()) start, 2, func, arg);
-		//Run initial thread
-		current = initial_thread;
-		//ucontext_t* original = new ucontext_t();
-		setcontext(initial_thread);		
+		contextMake(&initial_thread->context, initial_thread->stack + pageSize, STACK_SIZE, start, func, arg);
+		initial_thread->priority = 0;
+		initial_thread->name[0] = 0;
+		initial_thread->id = 0;
+		runnable = 1;
+		runQueuePush(&self->queues[0], initial_thread);
 	}
 	catch (exception& e) {
-		interrupt_enable();
+		enableInterrupts();
 		return -1;		
 	}
+	//Start the other workers, which inherit this worker's signal mask; interrupts stay disabled from here on
+	sigset_t oldMask;
+	if(wantedWorkers > 1) {
+		struct sigaction action;
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = preempt;
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		sigaction(PREEMPT_SIGNAL, &action, NULL);
+		sigset_t mask;
+		pthread_sigmask(SIG_SETMASK, NULL, &oldMask);
+		mask = oldMask;
+		sigaddset(&mask, SIGALRM);
+		sigdelset(&mask, PREEMPT_SIGNAL);
+		pthread_sigmask(SIG_SETMASK, &mask, NULL);
+	}
+	numWorkers = wantedWorkers;
+	for(int i = 1; i < numWorkers; i++) {
+		if(pthread_create(&workers[i].pthread, NULL, workerMain, &workers[i]) != 0) {
+			numWorkers = i;
+			break;
+		}
+	}
+	if(numWorkers > 1) {
+		startTimeSlices();
+	}
+	else if(wantedWorkers > 1) {
+		//No other worker started, so the interrupt layer stays in charge
+		pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+	}
+	//Run initial thread; this kernel thread becomes worker 0 and never returns
+	idleLoop(self);
 //	cout << "libinit" << endl;
-	interrupt_enable();
 	return -1;
 }
 
 int thread_create(thread_startfunc_t func, void *arg) {
-	interrupt_disable();
+	return thread_create_attr(func, arg, NULL);
+}
+
+int thread_create_attr(thread_startfunc_t func, void *arg, const thread_attr_t *attr) {
+	return thread_create_joinable(func, arg, attr, NULL);
+}
+
+//Creates a joinable thread if handle is not NULL, a detached one otherwise
+int thread_create_joinable(thread_startfunc_t func, void *arg, const thread_attr_t *attr, thread_handle_t *handle) {
+	size_t stackSize = STACK_SIZE;
+	bool lazy = false;
+	int priority = 0;
+	const char* name = NULL;
+	if(attr != NULL) {
+		lazy = attr->lazy_stack;
+		if(attr->stack_size != 0) {
+			stackSize = attr->stack_size < MIN_STACK_SIZE ? MIN_STACK_SIZE : attr->stack_size;
+		}
+		else if(lazy) {
+			stackSize = LAZY_STACK_SIZE;
+		}
+		priority = attr->priority > 0 ? PRIORITIES - 1 : 0;
+		name = attr->name;
+	}
+	disableInterrupts();
 	//If thread_libinit hasn't been called yet, return error
 	if(!initialized) {
-		interrupt_enable();
+		enableInterrupts();
 		return -1;
 	}
-	try {
-		ucontext_t* new_thread = new ucontext_t();
-		getcontext(new_thread);
-		char *stack = new char[STACK_SIZE];
-		new_thread->uc_stack.ss_sp = stack;
-		new_thread->uc_stack.ss_size = STACK_SIZE;
-		new_thread->uc_stack.ss_flags = 0;
-		new_thread->uc_link = NULL;
-		makecontext(new_thread, (void (*)()) start, 2, func, arg);
-		readyQueue.push_front(new_thread);
+	//Create context of new thread and push in onto the ready queue
+	stackSize = (stackSize + pageSize - 1) & ~(pageSize - 1);
+	if(stackSize < MIN_STACK_SIZE) {
+		//Rounding up wrapped around
+		enableInterrupts();
+		return -1;
 	}
-	catch (exception& e) {
-		interrupt_enable();
+	thread_t* new_thread = threadAlloc(thisWorker(), stackSize, lazy);
+	if(new_thread == NULL) {
+		enableInterrupts();
 		return -1;
 	}
-	
-	//Create context of new thread and push in onto the ready queue
+	contextMake(&new_thread->context, new_thread->stack + pageSize, stackSize, start, func, arg);
+	new_thread->priority = priority;
+	new_thread->name[0] = 0;
+	if(name != NULL) {
+		strncat(new_thread->name, name, sizeof(new_thread->name) - 1);
+	}
+	new_thread->id = 0;
+	if(handle != NULL) {
+		lockGuard();
+		//Skip 0 and handles still in use after the counter wraps around
+		do {
+			lastId++;
+		} while(lastId == 0 || tableFind(&joins, lastId) != NULL);
+		join_t* entry = tableInsert(&joins, lastId);
+		if(entry != NULL) {
+			new_thread->id = lastId;
+		}
+		unlockGuard();
+		if(entry == NULL) {
+			threadFree(thisWorker(), new_thread);
+			enableInterrupts();
+			return -1;
+		}
+		*handle = new_thread->id;
+	}
+	//New threads start on this worker's queue, where they are likely to find the creator's data still in cache
+	makeReady(new_thread);
 	
 //	cout << "NEW" << endl;
 	
 //	cout << "new thread: " << new_thread << endl;
-	interrupt_enable();
+	enableInterrupts();
 	return 0;
 }
 
 int thread_yield(void) {
 	//If thread_libinit hasn't been called yet, return error
-	interrupt_disable();
+	disableInterrupts();
 	if(!initialized) {
-		interrupt_enable();
+		enableInterrupts();
 		return -1;
 	}
-	//Add current context to ready queue and swap into next context on the ready queue
+	//Swap into the next ready context; the current one goes back on the run queue once it is saved
 	//	cout << "YIELDED" << endl;
-	readyQueue.push_front(current);
-//	cout << "Yield" << endl;
-	switchNext();
-	interrupt_enable();
+	yieldCurrent();
+	enableInterrupts();
+	return 0;
+}
+
+int thread_join(thread_handle_t handle, void **value) {
+	enter();
+	//If thread_libinit hasn't been called yet, return error
+	if(!initialized) {
+		leave();
+		return -1;
+	}
+	join_t* entry = tableFind(&joins, handle);
+	//Unknown, detached, already being joined, or the caller itself
+	if(entry == NULL || entry->detached || entry->joiner != NULL || handle == thisWorker()->current->id) {
+		leave();
+		return -1;
+	}
+	if(!entry->finished) {
+		entry->joiner = thisWorker()->current;
+		block();
+		//The table may have been rearranged while this thread was blocked
+		entry = tableFind(&joins, handle);
+	}
+	if(value != NULL) {
+		*value = entry->value;
+	}
+	tableRemove(&joins, entry);
+	leave();
+	return 0;
+}
+
+int thread_detach(thread_handle_t handle) {
+	enter();
+	//If thread_libinit hasn't been called yet, return error
+	if(!initialized) {
+		leave();
+		return -1;
+	}
+	join_t* entry = tableFind(&joins, handle);
+	if(entry == NULL || entry->detached || entry->joiner != NULL) {
+		leave();
+		return -1;
+	}
+	//A finished thread only has its exit value left; otherwise it cleans up when it finishes
+	if(entry->finished) {
+		tableRemove(&joins, entry);
+	}
+	else {
+		entry->detached = true;
+	}
+	leave();
 	return 0;
 }
 
+int thread_exit(void *value) {
+	disableInterrupts();
+	//If thread_libinit hasn't been called yet, return error
+	if(!initialized) {
+		enableInterrupts();
+		return -1;
+	}
+	finishThread(value);
+	return -1;
+}
+
 int helper_lock(unsigned int lock) {
 	//If lock is not taken, give context the lock
 //	cout << "CURRENT HOLDER: " << current << endl;
-	if(lockHolder.find(lock) == lockHolder.end()) {
-		lockHolder.insert(pair<unsigned int, ucontext_t*>(lock, current));
+	lock_t* entry = tableFind(&locks, lock);
+	if(entry == NULL) {
+		entry = tableInsert(&locks, lock);
+		if(entry == NULL) {
+			return -1;
+		}
+		entry->holder = thisWorker()->current;
 //		cout << "LOCK GIVEN: " << current << endl;
 	}
 	//Otherwise, add the context to the lock queue
 	else {
 		//If lock is already held by current context, return error
-		if(lockHolder.at(lock) == current) {
+		if(entry->holder == thisWorker()->current) {
 			return -1;
 		}
-		//If there is no existing lock queue for the lock, make one
-		if(lockMap.find(lock) == lockMap.end()) {
-//			cout << "hi" << endl;
-			deque<ucontext_t*> lockQueue;
-			lockQueue.push_front(current);
-			lockMap.insert(pair<unsigned int, deque<ucontext_t*> >(lock, lockQueue));
-		}
-		//Otherwise use existing lock queue
-		else {
-//			cout << "ho" << endl;
-			deque<ucontext_t*> lockQueue = lockMap.at(lock);
-			lockMap.erase(lock);
-			lockQueue.push_front(current);
-			lockMap.insert(pair<unsigned int, deque<ucontext_t*> >(lock, lockQueue));
-		}
+		//The unlocking thread hands the lock over before waking this one
+		waitQueuePush(&entry->waiters, thisWorker()->current);
 //		cout << "lock" << endl;
-		switchNext();
+		block();
 	}
 	return 0;
 }
 
 int thread_lock(unsigned int lock) {
-	interrupt_disable();
+	enter();
 	//If thread_libinit hasn't been called yet, return error
 	if(!initialized) {
-		interrupt_enable();
+		leave();
 		return -1;
 	}
 
 	int val = helper_lock(lock);
 
-	interrupt_enable();
+	leave();
 	return val;
 }
 
 int helper_unlock(unsigned int lock) {
+	lock_t* entry = tableFind(&locks, lock);
 	//If lock is not currently locked, return -1
-	if (lockHolder.find(lock) == lockHolder.end()) {
+	if(entry == NULL) {
 		return -1;
 	}
-
-	//Otherwise, unlock the lock and give it to the next context in the lock queue
+	//If current thread does not hold the lock, return error
+	if(entry->holder != thisWorker()->current) {
+//		cout << "UNLOCK UNSUCCESSFUL" << endl;
+		return -1;
+	}
+//	cout << "UNLOCK SUCCESSFUL: " << endl;
+	//Give lock to next context in the lock queue and move it to the ready queue
+	thread_t* newHolder = waitQueuePop(&entry->waiters);
+	if(newHolder == NULL) {
+		tableRemove(&locks, entry);
+	}
 	else {
-		if(lockHolder.at(lock) == current) {
-//			cout << "UNLOCK SUCCESSFUL: " << endl;
-			lockHolder.erase(lock);
-			//Give lock to next context in the lock queue
-			if(lockMap.find(lock) != lockMap.end()) {
-				deque<ucontext_t*> lockQueue = lockMap.at(lock);
-				if(!lockQueue.empty()) {
-					//Move new lock holder to the ready queue
-					ucontext_t* newHolder = lockQueue.back();
-//					cout << "NEW HOLDER OF LOCK" << newHolder << endl;
-					readyQueue.push_front(newHolder);				
-					//Update lock queue
-					lockQueue.pop_back();
-					lockMap.erase(lock);
-					lockMap.insert(pair<unsigned int, deque<ucontext_t*> >(lock, lockQueue));	
-					lockHolder.insert(pair<unsigned int, ucontext_t*>(lock, newHolder));
-				}
-			}
-			return 0;
-		}
-		//If current thread does not hold the lock, return error
-		else {
-//			cout << "UNLOCK UNSUCCESSFUL" << endl;
-			return -1;
-		}
+//		cout << "NEW HOLDER OF LOCK" << newHolder << endl;
+		entry->holder = newHolder;
+		makeReady(newHolder);
 	}
 	return 0;
-	
 }
 
 int thread_unlock(unsigned int lock) {
-	interrupt_disable();
+	enter();
 	//If thread_libinit hasn't been called yet, return error
 	if(!initialized) {
-		interrupt_enable();
+		leave();
 		return -1;
 	}
 
 	int val = helper_unlock(lock);
 
-	interrupt_enable();
+	leave();
 	return val;
 	
 }
 
 int thread_wait(unsigned int lock, unsigned int cond) {
 	
-	interrupt_disable();
+	enter();
 	//If thread_libinit hasn't been called yet, return error
 	if(!initialized) {
-		interrupt_enable();
+		leave();
 		return -1;
 	}
 
-	if(lockHolder.find(lock) == lockHolder.end()) {
-		interrupt_enable();
+	lock_t* entry = tableFind(&locks, lock);
+	if(entry == NULL || entry->holder != thisWorker()->current) {
+		leave();
 		return -1;
 	}
-	if(lockHolder.at(lock) != current) {
-		interrupt_enable();
-		return -1;
+
+	//Put thread into the wait queue for the CV
+	condition_t condition = {lock, cond};
+	cond_t* waitQueue = tableFind(&conditions, condition);
+	if(waitQueue == NULL) {
+		waitQueue = tableInsert(&conditions, condition);
+		if(waitQueue == NULL) {
+			leave();
+			return -1;
+		}
 	}
+//	cout << "PUT IN WAIT QUEUE: " << current << endl;
+	waitQueuePush(&waitQueue->waiters, thisWorker()->current);
 
 	//Unlock thread
 	int unlockVal = helper_unlock(lock);
 //	cout << "WAIT CALLED: THREAD UNLOCKED" << endl;
 
-	condition_t condition = {lock, cond};
-	//Put thread into the wait queue for the CV
-	if(conditionMap.find(condition) == conditionMap.end()) {
-//		cout << "PUT IN WAIT QUEUE (1): " << current << endl;
-		deque<ucontext_t*> waitQueue;
-		waitQueue.push_front(current);
-		conditionMap.insert(pair<condition_t, deque<ucontext_t*> >(condition, waitQueue));
-	}
-	else {
-//		cout << "PUT IN WAIT QUEUE (2): " << current << endl;
-		deque<ucontext_t*> waitQueue = conditionMap.at(condition);
-		conditionMap.erase(condition);
-		waitQueue.push_front(current);
-		conditionMap.insert(pair<condition_t, deque<ucontext_t*> >(condition, waitQueue));
-	}
 	//Switch in next thread
 //	cout << "wait" << endl;
-	switchNext();
+	block();
 
 	//this code restarts here
 //	cout << "CURRENT THREAD: " << current << endl;
 	int lockVal = helper_lock(lock);
-	interrupt_enable();
+	leave();
 	return 0;
 }
 
 int thread_signal(unsigned int lock, unsigned int cond) {
-	interrupt_disable();
+	enter();
 	//If thread_libinit hasn't been called yet, return error
 	if(!initialized) {
-		interrupt_enable();
+		leave();
 		return -1;
 	}
 //	cout << "THREAD SIGNALLED" << endl;
 	condition_t condition = {lock, cond};
-	if(conditionMap.find(condition) != conditionMap.end()) {
-		deque<ucontext_t*> waitQueue = conditionMap.at(condition);
-		if(!waitQueue.empty()) {
-			ucontext_t* wokenUp = waitQueue.back();
-			waitQueue.pop_back();
-			conditionMap.erase(condition);
-			if(!waitQueue.empty()) {
-				conditionMap.insert(pair<condition_t, deque<ucontext_t*> >(condition, waitQueue));
-			}
-			//Add woken up thread to lock queue
-// 			if(lockMap.find(lock) == lockMap.end()) {
-// 				deque<ucontext_t*> lockQueue;
-// 				lockQueue.push_front(wokenUp);
-// 				lockMap.insert(pair<unsigned int, deque<ucontext_t*> >(lock, lockQueue));
-// //				cout << "THREAD WOKEN (1): "  << wokenUp << endl;
-// 			}
-// 			else {
-// 				deque<ucontext_t*> lockQueue = lockMap.at(lock);
-// 				lockMap.erase(lock);
-// 				lockQueue.push_front(wokenUp);
-// 				lockMap.insert(pair<unsigned int, deque<ucontext_t*> >(lock, lockQueue));
-// //				cout << "THREAD WOKEN (2): "  << wokenUp << endl;
-// 			}
-			//add thread to readyqueue, to run
-			readyQueue.push_front(wokenUp);
+	cond_t* waitQueue = tableFind(&conditions, condition);
+	if(waitQueue != NULL) {
+		thread_t* wokenUp = waitQueuePop(&waitQueue->waiters);
+		if(waitQueue->waiters.head == NULL) {
+			tableRemove(&conditions, waitQueue);
 		}
+		//add thread to readyqueue, to run; it takes the lock again in thread_wait
+		makeReady(wokenUp);
 	}
-	interrupt_enable();
+	leave();
 	return 0;
 }
 
 int thread_broadcast(unsigned int lock, unsigned int cond) {
-	interrupt_disable();
+	enter();
 	//If thread_libinit hasn't been called yet, return error
 	if(!initialized) {
-		interrupt_enable();
+		leave();
 		return -1;
 	}
 //	cout << "THREAD BROADCAST" << endl;
 	condition_t condition = {lock, cond};
-	while(conditionMap.find(condition) != conditionMap.end()) {
-		deque<ucontext_t*> waitQueue = conditionMap.at(condition);
-		if(!waitQueue.empty()) {
-			ucontext_t* wokenUp = waitQueue.back();
-			waitQueue.pop_back();
-			conditionMap.erase(condition);
-			if(!waitQueue.empty()) {
-				conditionMap.insert(pair<condition_t, deque<ucontext_t*> >(condition, waitQueue));
-			}
-			//Add woken up thread to lock queue
-			// if(lockMap.find(lock) == lockMap.end()) {
-			// 	deque<ucontext_t*> lockQueue;
-			// 	lockQueue.push_front(wokenUp);
-			// 	lockMap.insert(pair<unsigned int, deque<ucontext_t*> >(lock, lockQueue));
-			// }
-			// else {
-			// 	deque<ucontext_t*> lockQueue = lockMap.at(lock);
-			// 	lockMap.erase(lock);
-			// 	lockQueue.push_front(wokenUp);
-			// 	lockMap.insert(pair<unsigned int, deque<ucontext_t*> >(lock, lockQueue));
-			// }
-			readyQueue.push_front(wokenUp);
+	cond_t* waitQueue = tableFind(&conditions, condition);
+	if(waitQueue != NULL) {
+		thread_t* wokenUp = waitQueue->waiters.head;
+		tableRemove(&conditions, waitQueue);
+		while(wokenUp != NULL) {
+			thread_t* next = wokenUp->next;
+			makeReady(wokenUp);
+			wokenUp = next;
 		}
 //		cout << "THREADS WOKEN" << endl;
 	}
-	interrupt_enable();
+	leave();
 	return 0;
-}
\ No newline at end of file
+}
@@ -8,15 +8,49 @@
 #define _THREAD_H
 
 #define STACK_SIZE 262144	/* size of each thread's stack */
+#define LAZY_STACK_SIZE 8388608	/* default size of a lazily committed stack */
+#define MIN_STACK_SIZE 16384	/* smaller stack sizes are rounded up to this */
 
 typedef void (*thread_startfunc_t) (void *);
+typedef unsigned int thread_handle_t;	/* identifies a joinable thread; never 0 */
+
+/*
+ * Attributes of a new thread, for thread_create_attr. Zero-initialize and set
+ * only the fields you need.
+ */
+struct thread_attr_t {
+	unsigned long stack_size;	/* bytes of stack, 0 for the default */
+	bool lazy_stack;	/* reserve the stack's address space but commit pages only as they are touched */
+	const char *name;	/* for debugging output; up to 15 characters are kept */
+	int priority;	/* 0 for normal, above 0 to run before normal threads */
+};
 
 extern int thread_libinit(thread_startfunc_t func, void *arg); 
 	//initializes thread library, called once at v beginning creates and runs first thread
 	//calls func with argument arg
 	//control transfers to func
+	//threads run on THREAD_WORKERS kernel threads if set in the environment (M:N), on one otherwise
+	//with more than one worker each worker preempts its thread every 10 ms of CPU time; start_preemptions has no effect
 extern int thread_create(thread_startfunc_t func, void *arg);
 	//creates new thread and calls func
+extern int thread_create_attr(thread_startfunc_t func, void *arg, const thread_attr_t *attr);
+	//same as thread_create, with the attributes in attr (NULL for defaults)
+	//the default stack is STACK_SIZE bytes, or LAZY_STACK_SIZE for a lazy stack
+	//a lazy stack uses memory only for the pages the thread touches, so many mostly idle threads stay cheap
+	//every stack has an inaccessible guard page below it, so an overflow crashes instead of corrupting memory
+	//each stack takes two kernel memory mappings, so more than about 30000 live threads need vm.max_map_count raised
+extern int thread_create_joinable(thread_startfunc_t func, void *arg, const thread_attr_t *attr, thread_handle_t *handle);
+	//same as thread_create_attr, and stores a handle for thread_join or thread_detach in *handle
+	//other threads are detached from the start
+extern int thread_join(thread_handle_t handle, void **value);
+	//waits for the thread to finish and stores its exit value in *value unless value is NULL
+	//a thread can be joined once, by one thread; fails for detached threads and for the caller itself
+extern int thread_detach(thread_handle_t handle);
+	//lets the thread be cleaned up when it finishes without being joined
+extern int thread_exit(void *value);
+	//ends the calling thread with exit value value; returning from its start function is thread_exit(NULL)
+	//does not return except on error; destructors of objects on the thread's stack are not run
+	//a finished thread's stack is reused or unmapped right away, only its exit value is kept until joined
 extern int thread_yield(void);
 	//causes current thread to yield CPU to next runnable thread
 	//no effect if no other runnable threads
@@ -0,0 +1,42 @@
+#include <cstdlib>
+#include <iostream>
+#include <time.h>
+#include "thread.h"
+using namespace std;
+
+//Yield ping-pong: two threads yield to each other, so every thread_yield is
+//one context switch. Reports the time per switch. Run with one worker
+//(THREAD_WORKERS unset) and compare a build of thread.cc with -DTHREAD_UCONTEXT.
+//Usage: yield_bench [yields per thread]
+
+int yields = 1000000; //Yields done by each thread
+double startTime; //Time the first thread started
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void player(void *a) {
+	for(int i = 0; i < yields; i++) {
+		thread_yield();
+	}
+	if((long) a == 1) {
+		double elapsed = now() - startTime;
+		cout << 2 * yields << " switches in " << elapsed << " seconds, " << elapsed * 1e9 / (2 * yields) << " ns per switch" << endl;
+	}
+}
+
+void root(void *a) {
+	thread_create((thread_startfunc_t) player, (void*) 0);
+	thread_create((thread_startfunc_t) player, (void*) 1);
+	startTime = now();
+}
+
+int main(int argc, char *argv[]) {
+	if(argc > 1) {
+		yields = atoi(argv[1]);
+	}
+	thread_libinit((thread_startfunc_t) root, NULL);
+}